@@ -0,0 +1,181 @@
+#include <filesystem>
+#include <vector>
+
+#include "benchmark/benchmark.h"
+#include "combinations/Combinations.hpp"
+#include "combinations/Component.hpp"
+
+namespace {
+
+const std::filesystem::path path{"test/etc/combinations.xml"};
+
+// Rules shared by the benchmarks, loaded once. If they failed to load, the benchmark is skipped with an error and
+// nullptr is returned, rather than timing an empty rule set.
+const Combinations* rules(benchmark::State& state) {
+    static Combinations combinations;
+    static const bool loaded = combinations.load(path);
+    if (!loaded) {
+        state.SkipWithError("Failed to load test/etc/combinations.xml");
+        return nullptr;
+    }
+    return &combinations;
+}
+
+const std::vector<Component> future_condor = {
+    Component::from_string("F 1 2010-03-04"),
+    Component::from_string("F -1 2010-03-02"),
+    Component::from_string("F 1 2010-03-01"),
+    Component::from_string("F -1 2010-03-03"),
+};
+
+const std::vector<Component> bundle = {
+    Component::from_string("F 1 2010-12-01"), Component::from_string("F 1 2010-09-01"),
+    Component::from_string("F 1 2010-06-01"), Component::from_string("F 1 2010-03-01"),
+    Component::from_string("F 1 2010-12-01"), Component::from_string("F 1 2010-09-01"),
+    Component::from_string("F 1 2010-06-01"), Component::from_string("F 1 2010-03-01"),
+};
+
+const std::vector<Component> iron_condor = {
+    Component::from_string("C -1 2300 2010-03-01"),
+    Component::from_string("C 1 2200 2010-03-01"),
+    Component::from_string("P 1 2100 2010-03-01"),
+    Component::from_string("P -1 2000 2010-03-01"),
+};
+
+const std::vector<Component> iron_condor_vs_underlying = {
+    Component::from_string("U 10 2010-03-01"),      Component::from_string("C -1 2300 2010-03-01"),
+    Component::from_string("C 1 2200 2010-03-01"),  Component::from_string("P 1 2100 2010-03-01"),
+    Component::from_string("P -1 2000 2010-03-01"),
+};
+
+const std::vector<Component> straddle_calendar_spread_vs_underlying = {
+    Component::from_string("U -10 2010-03-01"),    Component::from_string("C 1 2000 2010-03-02"),
+    Component::from_string("P 1 2000 2010-03-02"), Component::from_string("C -1 2000 2010-03-01"),
+    Component::from_string("P -1 2000 2010-03-01"),
+};
+
+// Matches the signature of the iron condor versus underlying rules, but its strikes are out of order, so every
+// candidate rule is searched through before giving up.
+const std::vector<Component> unclassified = {
+    Component::from_string("U 10 2010-03-01"),      Component::from_string("C -1 2000 2010-03-01"),
+    Component::from_string("C 1 2100 2010-03-01"),  Component::from_string("P 1 2200 2010-03-01"),
+    Component::from_string("P -1 2300 2010-03-01"),
+};
+
+// Three years of quarterly futures, one of them with a ratio no leg of Bundle accepts, so only a Strip fits. Each
+// copy of the Bundle legs still passes the ratio prefilter.
+const std::vector<Component> bundle_mismatch = {
+    Component::from_string("F 1 2010-03-01"), Component::from_string("F 1 2010-06-01"),
+    Component::from_string("F 1 2010-09-01"), Component::from_string("F 1 2010-12-01"),
+    Component::from_string("F 1 2010-03-01"), Component::from_string("F 1 2010-06-01"),
+    Component::from_string("F 1 2010-09-01"), Component::from_string("F 1 2010-12-01"),
+    Component::from_string("F 1 2010-03-01"), Component::from_string("F 1 2010-06-01"),
+    Component::from_string("F 1 2010-09-01"), Component::from_string("F 2 2010-12-01"),
+};
+
+// Ten years of quarterly futures, latest first.
+const std::vector<Component> bundle_long = [] {
+    std::vector<Component> components;
+    for (int year = 2019; year >= 2010; --year) {
+        for (const char* date : {"-12-01", "-09-01", "-06-01", "-03-01"}) {
+            components.push_back(Component::from_string("F 1 " + std::to_string(year) + date));
+        }
+    }
+    return components;
+}();
+
+void BM_CombinationsLoad(benchmark::State& state) {
+    for (auto _ : state) {
+        Combinations tmp;
+        if (!tmp.load(path)) {
+            state.SkipWithError("Failed to load test/etc/combinations.xml");
+            break;
+        }
+    }
+}
+BENCHMARK(BM_CombinationsLoad)->Unit(benchmark::kMicrosecond);
+
+void BM_Classify(benchmark::State& state, const std::vector<Component>& components) {
+    const Combinations* combinations = rules(state);
+    if (!combinations) {
+        return;
+    }
+    std::vector<int> order;
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(combinations->classify(components, order));
+    }
+}
+BENCHMARK_CAPTURE(BM_Classify, future_condor, future_condor);
+BENCHMARK_CAPTURE(BM_Classify, bundle, bundle);
+BENCHMARK_CAPTURE(BM_Classify, iron_condor, iron_condor);
+BENCHMARK_CAPTURE(BM_Classify, iron_condor_vs_underlying, iron_condor_vs_underlying);
+BENCHMARK_CAPTURE(BM_Classify, straddle_calendar_spread_vs_underlying, straddle_calendar_spread_vs_underlying);
+BENCHMARK_CAPTURE(BM_Classify, unclassified, unclassified);
+BENCHMARK_CAPTURE(BM_Classify, bundle_mismatch, bundle_mismatch);
+BENCHMARK_CAPTURE(BM_Classify, bundle_long, bundle_long);
+
+void BM_Match(benchmark::State& state, const std::vector<Component>& components) {
+    const Combinations* combinations = rules(state);
+    if (!combinations) {
+        return;
+    }
+    std::vector<int> order;
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(combinations->match(components, order));
+    }
+}
+BENCHMARK_CAPTURE(BM_Match, iron_condor_vs_underlying, iron_condor_vs_underlying);
+BENCHMARK_CAPTURE(BM_Match, unclassified, unclassified);
+
+const std::vector<std::vector<Component>> batch = {
+    future_condor, bundle, iron_condor, iron_condor_vs_underlying, straddle_calendar_spread_vs_underlying, unclassified,
+};
+
+// Requests as they come from a feed, where most sets match no rule and are rejected by the signature and ratio
+// checks alone.
+const std::vector<std::vector<Component>> stream = [] {
+    const std::vector<std::vector<Component>> rejected = {
+        {Component::from_string("U 1 2010-03-01"), Component::from_string("F -1 2010-03-01")},
+        {Component::from_string("C 5 2000 2010-03-01"), Component::from_string("P -5 2000 2010-03-01"),
+         Component::from_string("F 2 2010-06-01")},
+        {Component::from_string("F 1 2010-03-01"), Component::from_string("F -1 2010-06-01"),
+         Component::from_string("F 1 2010-09-01"), Component::from_string("U -1 2010-03-01")},
+    };
+    std::vector<std::vector<Component>> tmp;
+    for (std::size_t i = 0; i < 16; i++) {
+        tmp.insert(tmp.end(), rejected.begin(), rejected.end());
+        tmp.push_back(batch[i % batch.size()]);
+    }
+    return tmp;
+}();
+
+void BM_ClassifyBatch(benchmark::State& state, const std::vector<std::vector<Component>>& batch) {
+    const Combinations* combinations = rules(state);
+    if (!combinations) {
+        return;
+    }
+    ClassifiedBatch result;
+    for (auto _ : state) {
+        combinations->classify_batch(batch, result);
+        benchmark::DoNotOptimize(result.rules.data());
+    }
+}
+BENCHMARK_CAPTURE(BM_ClassifyBatch, mixed, batch);
+BENCHMARK_CAPTURE(BM_ClassifyBatch, stream, stream);
+
+void BM_ClassifyComponentBatch(benchmark::State& state, const std::vector<std::vector<Component>>& batch) {
+    const Combinations* combinations = rules(state);
+    if (!combinations) {
+        return;
+    }
+    const ComponentBatch columns{batch};
+    ClassifiedBatch result;
+    for (auto _ : state) {
+        combinations->classify_batch(columns, result);
+        benchmark::DoNotOptimize(result.rules.data());
+    }
+}
+BENCHMARK_CAPTURE(BM_ClassifyComponentBatch, mixed, batch);
+BENCHMARK_CAPTURE(BM_ClassifyComponentBatch, stream, stream);
+
+}  // anonymous namespace
@@ -0,0 +1,39 @@
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "benchmark/benchmark.h"
+#include "combinations/Component.hpp"
+
+namespace {
+
+const std::vector<std::string> lines = {
+    "F 1 2010-03-01",
+    "U -10 2010-03-01",
+    "C -1 2100 2010-03-02",
+    "P 1.5 1999.75 2010-12-31",
+};
+
+void BM_ComponentFromStream(benchmark::State& state) {
+    for (auto _ : state) {
+        for (const auto& line : lines) {
+            std::istringstream strm{line};
+            benchmark::DoNotOptimize(Component::from_stream(strm));
+        }
+    }
+    state.SetItemsProcessed(state.iterations() * lines.size());
+}
+BENCHMARK(BM_ComponentFromStream);
+
+void BM_ComponentParse(benchmark::State& state) {
+    Component component;
+    for (auto _ : state) {
+        for (const auto& line : lines) {
+            benchmark::DoNotOptimize(Component::parse(line, component));
+        }
+    }
+    state.SetItemsProcessed(state.iterations() * lines.size());
+}
+BENCHMARK(BM_ComponentParse);
+
+}  // anonymous namespace
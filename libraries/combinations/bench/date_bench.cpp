@@ -0,0 +1,18 @@
+#include "benchmark/benchmark.h"
+#include "combinations/DateWrap.hpp"
+
+namespace {
+
+void BM_DateCheckOffset(benchmark::State& state, TimePeriods period, Date test_date) {
+    const Date date{2010, 1, 31};
+    const ExpirationOffset offset{2, period};
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(date.check_offset(offset, test_date));
+    }
+}
+BENCHMARK_CAPTURE(BM_DateCheckOffset, days, TimePeriods::d, Date(2010, 2, 2));
+BENCHMARK_CAPTURE(BM_DateCheckOffset, months, TimePeriods::m, Date(2010, 3, 31));
+BENCHMARK_CAPTURE(BM_DateCheckOffset, quarters, TimePeriods::q, Date(2010, 7, 15));
+BENCHMARK_CAPTURE(BM_DateCheckOffset, years, TimePeriods::y, Date(2012, 1, 31));
+
+}  // anonymous namespace
@@ -0,0 +1,10 @@
+#ifndef COMBINATIONS_BUILTINRULES_HPP
+#define COMBINATIONS_BUILTINRULES_HPP
+
+#include "Combinations.hpp"
+
+// Rules of etc/combinations.xml as of the build, embedded into the combinations_builtin library as a compiled image by
+// the rules_codegen tool. Loading them reads no file and parses no XML, otherwise it is the same as load.
+bool load_builtin_rules(Combinations& combinations);
+
+#endif  // COMBINATIONS_BUILTINRULES_HPP
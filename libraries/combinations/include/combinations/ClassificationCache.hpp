@@ -0,0 +1,57 @@
+#ifndef COMBINATIONS_CLASSIFICATIONCACHE_HPP
+#define COMBINATIONS_CLASSIFICATIONCACHE_HPP
+
+#include <atomic>
+#include <list>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+#include "Combinations.hpp"
+#include "Component.hpp"
+
+// Bounded memo of Combinations::match results keyed by the set of components regardless of their order. It is split
+// into independently locked shards, each evicting its least recently used entries, so it can be shared by threads.
+class ClassificationCache {
+public:
+    // The capacity is split exactly between the shards, the first ones taking the remainder. There are fewer shards
+    // than asked for if the capacity is smaller, so that each holds at least one entry.
+    ClassificationCache(const Combinations& combinations, std::size_t capacity, std::size_t shards = 16);
+
+    // Same as Combinations::match. On a hit the cached order is mapped onto the positions of the given components;
+    // when several orders are acceptable it may differ from the one Combinations::match would pick for them.
+    const Combination* match(const std::vector<Component>& components, std::vector<int>& order);
+
+    std::size_t capacity() const;
+    // Number of entries held.
+    std::size_t size() const;
+    std::size_t hits() const;
+    std::size_t misses() const;
+
+private:
+    // Components sorted into the canonical order and the order of the rule legs they take, zero if unclassified.
+    struct Entry {
+        std::size_t hash;
+        std::vector<Component> components;
+        const Combination* rule;
+        std::vector<int> order;
+    };
+
+    struct Shard {
+        mutable std::mutex mutex;
+        std::size_t capacity = 0;
+        std::list<Entry> entries;
+        std::unordered_multimap<std::size_t, std::list<Entry>::iterator> index;
+    };
+
+    const Combinations& combinations;
+    const std::size_t total_capacity;
+    std::vector<Shard> shards;
+    std::atomic<std::size_t> hits_count{0};
+    std::atomic<std::size_t> misses_count{0};
+
+    static void canonicalize(const std::vector<Component>& components, std::vector<std::size_t>& positions);
+    static std::size_t hash(const std::vector<Component>& components, const std::vector<std::size_t>& positions);
+};
+
+#endif  // COMBINATIONS_CLASSIFICATIONCACHE_HPP
@@ -0,0 +1,73 @@
+#ifndef COMBINATIONS_CLASSIFIERPOOL_HPP
+#define COMBINATIONS_CLASSIFIERPOOL_HPP
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <stop_token>
+#include <thread>
+#include <vector>
+
+#include "Combinations.hpp"
+#include "Component.hpp"
+
+// Fixed set of worker threads classifying batches of component sets against shared rules. A batch is cut into chunks
+// spread over per-worker queues; a worker takes its own chunks from the back and, once out of them, steals from the
+// front of the others.
+class ClassifierPool {
+public:
+    using Batch    = std::vector<std::vector<Component>>;
+    using Callback = std::function<void(ClassifiedBatch&&)>;
+
+    ClassifierPool(const Combinations& combinations, std::size_t threads = std::thread::hardware_concurrency());
+
+    ClassifierPool(const ClassifierPool&)            = delete;
+    ClassifierPool& operator=(const ClassifierPool&) = delete;
+
+    // Waits for the submitted batches to be classified.
+    ~ClassifierPool();
+
+    std::future<ClassifiedBatch> submit(Batch&& batch);
+
+    // The callback is called once from a worker thread, or right away for an empty batch.
+    void submit(Batch&& batch, Callback&& callback);
+
+    // Same as Combinations::match, but requests of at least parallel_legs components have their candidate rules tried
+    // concurrently on the workers. The first candidate in priority order that matches still wins, and the ones after
+    // it are cancelled as soon as it does. Must not be called from a callback, i.e. from a worker.
+    const Combination* match(const std::vector<Component>& components, std::vector<int>& order);
+
+    std::size_t size() const;
+
+    static constexpr std::size_t parallel_legs = 8;
+
+private:
+    using Task = std::function<void()>;
+
+    struct Queue {
+        std::mutex mutex;
+        std::deque<Task> tasks;
+    };
+
+    const Combinations& combinations;
+    std::vector<Queue> queues;
+    std::vector<std::thread> workers;
+
+    std::mutex sleep_mutex;
+    std::condition_variable sleep;
+    std::atomic<std::size_t> queued{0};
+    bool stopping = false;
+
+    std::atomic<std::size_t> next_queue{0};
+
+    void push(Task&& task);
+    void wake();
+    void run(std::size_t self);
+    bool take(std::size_t self, Task& task);
+};
+
+#endif  // COMBINATIONS_CLASSIFIERPOOL_HPP
@@ -2,22 +2,40 @@
 #define COMBINATIONS_COMBINATIONS_HPP
 
 #include <algorithm>
+#include <array>
+#include <cstdint>
 #include <cstring>
 #include <filesystem>
+#include <limits>
 #include <memory>
 #include <numeric>
+#include <ostream>
 #include <pugixml.hpp>
+#include <span>
+#include <stop_token>
 #include <string>
+#include <string_view>
+#include <thread>
 #include <unordered_map>
 #include <unordered_set>
 #include <variant>
 #include <vector>
 
 #include "Component.hpp"
+#include "ComponentBatch.hpp"
 #include "DateWrap.hpp"
+#include "RuleStats.hpp"
 
 class Combination;
 
+enum class Cardinality : char { fixed, multiple, more };
+
+struct CombinationNames {
+    std::string name;
+    std::string shortname;
+    std::string identifier;
+};
+
 struct Leg {
     InstrumentType type;
     std::variant<char, double> ratio;
@@ -28,8 +46,58 @@ struct Leg {
     static constexpr char invalid_expiration = '\u0000';
 };
 
+// Instrument types and ratio signs of a set of legs or components, counted regardless of their order. Two sets can
+// only be matched leg by leg if their signatures are equal. As signs are counted, the variants of a structure that
+// differ by the sign of one leg, like XvbU and XvsU, never share a candidate list.
+struct LegsSignature {
+    std::array<std::size_t, 6> types{};
+    std::size_t positive = 0;
+    std::size_t negative = 0;
+
+    static LegsSignature of(const std::vector<Leg>& legs);
+    static LegsSignature of(const std::vector<Component>& components);
+    static LegsSignature of(const ComponentBatch& batch, std::size_t set);
+
+    // Signature divided by the greatest common divisor of its counts, so that k copies of a set of legs reduce to the
+    // same value as the set itself.
+    LegsSignature reduced() const;
+
+    bool operator==(const LegsSignature& other) const = default;
+};
+
+// Numbers of legs or components by instrument type and exact ratio among -3 .. -1 and 1 .. 3, padded to one 32 byte
+// vector. A leg with such a ratio can only take a component with the same type and ratio, so a rule may only accept
+// components whose counts are all at least its own, which covers compares in one or two vector instructions.
+struct RatioHistogram {
+    static constexpr std::size_t max_ratio = 3;
+
+    alignas(32) std::array<std::uint8_t, 32> counts{};
+
+    // Counts the legs with an exact ratio, the ones accepting any ratio of a sign are not counted.
+    static RatioHistogram of(const std::vector<Leg>& legs);
+    // Counts saturate at 255, which is still at least the count of any rule.
+    static RatioHistogram of(const std::vector<Component>& components);
+    static RatioHistogram of(const ComponentBatch& batch, std::size_t set);
+
+    bool covers(const RatioHistogram& rule) const;
+};
+
+struct LegsSignatureHash {
+    std::size_t operator()(const LegsSignature& signature) const;
+};
+
+// Results of Combinations::classify_batch laid out in flat arrays. The order of the i-th set of components occupies
+// orders[offsets[i]] .. orders[offsets[i + 1]] and is left zeroed if the set was not classified.
+struct ClassifiedBatch {
+    std::vector<std::size_t> rules;
+    std::vector<std::size_t> offsets;
+    std::vector<int> orders;
+};
+
 class Combinations {
 public:
+    static constexpr std::size_t unclassified = std::numeric_limits<std::size_t>::max();
+
     Combinations() = default;
 
     static void set_ratio(pugi::xml_node& leg_xml, Leg& leg);
@@ -38,25 +106,112 @@ public:
 
     std::vector<Leg> parse_legs(pugi::xml_node& legs_xml);
 
+    // Adds the rules of the resource. On failure none of them is added.
     bool load(const std::filesystem::path& resource);
 
+    // Binary image of the loaded rules, which load_compiled reads back from a memory mapping without any XML parsing.
+    // It is versioned and checksummed, and stored in the native byte order.
+    bool save_compiled(const std::filesystem::path& snapshot) const;
+    bool load_compiled(const std::filesystem::path& snapshot);
+
+    // The same image in memory, for rules embedded into a binary, see BuiltinRules.hpp.
+    std::string compiled_image() const;
+    bool load_image(std::string_view image);
+
     std::string classify(const std::vector<Component>& components, std::vector<int>& order) const;
 
+    // Same as classify, but returns the accepting rule itself, or nullptr if there is none, and writes the order into
+    // the given vector in place. The rule stays valid as long as this object, so nothing is copied or allocated once
+    // the order vector has enough capacity.
+    const Combination* match(const std::vector<Component>& components, std::vector<int>& order) const;
+
+    // Classifies every set of components of the batch, splitting it between the given number of threads. The buffers
+    // of the result are reused, so passing the same one again does not allocate unless the batch grows.
+    void classify_batch(std::span<const std::vector<Component>> batch, ClassifiedBatch& result,
+                        std::size_t threads = 1) const;
+
+    // The two steps of classify_batch, for callers scheduling the work themselves: sizing the result for the batch,
+    // then classifying the sets begin .. end of it. Distinct ranges may be classified concurrently.
+    static void prepare_batch(std::span<const std::vector<Component>> batch, ClassifiedBatch& result);
+    void classify_range(std::span<const std::vector<Component>> batch, ClassifiedBatch& result, std::size_t begin,
+                        std::size_t end) const;
+
+    // Same as the above for a batch stored column by column. The signatures and ratio histograms picking the candidate
+    // rules are counted over the columns, and only the sets left with a candidate are copied into a reused buffer for
+    // the rules to search them.
+    void classify_batch(const ComponentBatch& batch, ClassifiedBatch& result, std::size_t threads = 1) const;
+    static void prepare_batch(const ComponentBatch& batch, ClassifiedBatch& result);
+    void classify_range(const ComponentBatch& batch, ClassifiedBatch& result, std::size_t begin,
+                        std::size_t end) const;
+
+    // Positions of the rules that may accept the components, in priority order.
+    void candidates(const std::vector<Component>& components, std::vector<std::size_t>& rules) const;
+
+    // Counters of the rules tried by classify, match and the batches, by rule position. Empty unless the library is
+    // built with COMBINATIONS_STATS.
+    std::vector<RuleCounters> stats() const;
+
+    // Prints the counters of the rules tried so far, the most time consuming first.
+    void dump_stats(std::ostream& out) const;
+
+    std::size_t size() const;
+    const Combination* rule(std::size_t rule) const;
+    const std::string& rule_name(std::size_t rule) const;
+
+    // Tries a single rule on the components, counting it in the stats, for callers that pick the candidates
+    // themselves. tmp_order must have the size of the components and receives the component of each leg slot.
+    bool try_rule(std::size_t rule, const std::vector<Component>& components, std::vector<int>& tmp_order,
+                  std::stop_token stop = {}) const;
+
 private:
+    using RulesIndex = std::unordered_map<LegsSignature, std::vector<std::size_t>, LegsSignatureHash>;
+
     std::vector<std::unique_ptr<Combination>> combinations;
+
+    // Positions in combinations of the rules that may accept a set of components: fixed rules by the exact
+    // signature, multiple rules by the reduced one, more rules are always tried.
+    RulesIndex fixed_index;
+    RulesIndex multiple_index;
+    std::vector<std::size_t> more_index;
+
+    // Exact ratios required by each rule, by position.
+    std::vector<RatioHistogram> ratio_histograms;
+
+    std::unique_ptr<RuleStats> rule_stats;
+
+    // Fails, adding nothing, only if a fixed or multiple rule has more symbols than MultipleCombination::supports.
+    bool add_rule(Cardinality cardinality, CombinationNames&& names, std::size_t min_count, std::vector<Leg>&& legs);
+
+    // Sizes the stats to the rules once they are added, keeping the counts gathered so far.
+    void size_stats();
+
+    // Position of the first rule accepting the components or unclassified, tmp_order must have their size.
+    std::size_t find_rule(const std::vector<Component>& components, std::vector<int>& tmp_order) const;
+    std::size_t find_rule(const std::vector<Component>& components, const LegsSignature& signature,
+                          const RatioHistogram& ratios, std::vector<int>& tmp_order) const;
+
+    // Whether any rule may accept components with the signature and ratios, without looking at the components.
+    bool has_candidate(const LegsSignature& signature, const RatioHistogram& ratios) const;
 };
 
 class Combination {
 public:
-    Combination(std::string&& name, std::vector<Leg>&& legs);
+    Combination(CombinationNames&& names, std::vector<Leg>&& legs);
+
+    const std::string& get_name() const;
+    const std::string& get_shortname() const;
+    const std::string& get_identifier() const;
+    const std::vector<Leg>& get_legs() const;
 
-    std::string get_name() const;
+    virtual Cardinality get_cardinality() const = 0;
 
-    virtual bool acceptable_combination(const std::vector<Component>& components, std::vector<int>& order) const = 0;
+    // Looks for an order of the components matching the legs, giving up with false once a stop is requested.
+    virtual bool acceptable_combination(const std::vector<Component>& components, std::vector<int>& order,
+                                        std::stop_token stop) const = 0;
 
     virtual ~Combination() = default;
 protected:
-    std::string name;
+    CombinationNames names;
     const std::vector<Leg> legs;
 
     virtual bool acceptable_type(const std::vector<Component>& components) const = 0;
@@ -65,17 +220,117 @@ protected:
 
 class MultipleCombination: public Combination {
 public:
-    MultipleCombination(std::string&& name, std::vector<Leg>&& legs);
+    // Upper bound of distinct strike and of distinct expiration symbols within the legs of a rule.
+    static constexpr std::size_t max_symbols = 8;
+
+    MultipleCombination(CombinationNames&& names, std::vector<Leg>&& legs);
+
+    static bool supports(const std::vector<Leg>& legs);
+
+    Cardinality get_cardinality() const override;
 
 protected:
-    bool acceptable_combination(const std::vector<Component>& components, std::vector<int>& order) const override;
+    enum class RatioCheck : char { exact, positive, negative };
+
+    // none: the value is free but still starts a new offset chain, bind: the value is equal to the one bound to a
+    // symbol slot, offset: the value is above/below the chain start or equal to the previous leg with the same amount
+    // of signs, period: the expiration is a given period after the previous one.
+    enum class ValueCheck : char { none, bind, offset, period };
+
+    // Leg lowered into plain checks at load time, so matching needs neither variant dispatch nor hashing.
+    struct CompiledLeg {
+        InstrumentType type;
+        RatioCheck ratio_check;
+        ValueCheck strike_check;
+        ValueCheck expiration_check;
+        double ratio;
+        int strike_arg;      // symbol slot for bind, signed amount of signs for offset
+        int expiration_arg;  // same as strike_arg
+        ExpirationOffset expiration_period;
+    };
+
+    // Everything a partial assignment has bound so far. It is small and trivially copyable, so the matcher keeps one
+    // copy per assigned leg instead of undoing its changes on backtracking.
+    struct LegsState {
+        std::array<double, max_symbols> strikes{};
+        std::array<Date, max_symbols> expirations{};
+        std::uint32_t bound_strikes     = 0;
+        std::uint32_t bound_expirations = 0;
+        double last_strike              = 0;
+        int strike_last_signs_amount    = 0;
+        Date last_expiration;
+        int expiration_last_signs_amount = 0;
+    };
+
+    // Requests up to this size, which covers every fixed rule, are matched in buffers on the stack.
+    static constexpr std::size_t inline_size = 16;
+
+    const std::vector<CompiledLeg> program;
+    std::uint32_t types_mask = 0;
+
+    // Legs, up to inline_size, whose type and ratio accept components no other leg does. With one component per leg,
+    // such a leg can only take the single component of the request it accepts, so its slot is assigned directly.
+    std::uint32_t forced_legs = 0;
+
+    // Whether a leg binds or orders its strike or expiration, otherwise the values of a request are not sorted.
+    bool ordered_values = false;
+
+    // Months after the first leg of each other leg, for rules made of a free leg and legs a whole number of quarters
+    // after it, all taking the same components, like Bundle. Such rules are split into groups of legs by partition
+    // instead of searched. Empty for the other rules.
+    std::vector<int> group_offsets;
 
-    bool check_strike(const std::variant<char, int>& leg_strike, std::unordered_map<char, double>& strikes,
-                      double& last_strike, std::size_t& last_signs_amount, const double& test_strike) const;
+    static std::vector<int> quarterly_offsets(const std::vector<CompiledLeg>& program);
 
-    bool check_expiration(const std::variant<char, int, ExpirationOffset>& leg_expiration,
-                          std::unordered_map<char, Date>& expirations, Date& last_expiration,
-                          std::size_t& last_signs_amount, const Date& test_expiration) const;
+    bool partition(const std::vector<Component>& components, std::vector<int>& order, std::stop_token stop) const;
+
+    static std::vector<CompiledLeg> compile(const std::vector<Leg>& legs);
+
+    // Requests of masked_size up to 64 components are searched over bitmasks of the components instead of trying them
+    // one by one. Smaller ones are searched faster than the masks are built.
+    static constexpr std::size_t masked_size     = 6;
+    static constexpr std::size_t max_masked_size = 64;
+
+    using LegsMasks = std::array<std::uint64_t, max_masked_size>;
+
+    // Strikes and expirations of a request in increasing order, with the masks of the components from each rank on.
+    // The components an offset or a bound value check can accept then take a binary search to find: the ones equal
+    // to, above or below the previous leg or the bound value.
+    struct SortedComponents {
+        explicit SortedComponents(const std::vector<Component>& components);
+
+        std::uint64_t strikes(const CompiledLeg& leg, const LegsState& state) const;
+        std::uint64_t expirations(const CompiledLeg& leg, const LegsState& state) const;
+
+        std::size_t size;
+        std::uint64_t all;
+        bool strikes_ordered = true;  // false if a strike is NaN, every component is kept then
+        std::array<double, max_masked_size> strike_values;
+        std::array<std::uint64_t, max_masked_size + 1> strikes_from;
+        std::array<std::int32_t, max_masked_size> expiration_values;
+        std::array<std::uint64_t, max_masked_size + 1> expirations_from;
+    };
+
+    // Masks of the components each leg accepts by type and ratio alone. Returns whether each leg slot can be given a
+    // distinct one of them, checked with a bipartite matching. Failing that, no assignment exists.
+    bool feasible(const std::vector<Component>& components, LegsMasks& legs_masks) const;
+
+    // The search of acceptable_combination, trying each component in turn or only the ones in the masks.
+    bool search(const std::vector<Component>& components, std::vector<int>& order, std::stop_token stop) const;
+    bool search_masked(const std::vector<Component>& components, std::vector<int>& order, std::stop_token stop,
+                       const LegsMasks& legs_masks) const;
+
+    static bool accepts_ratio(const CompiledLeg& leg, const Component& component);
+    static bool overlap(const CompiledLeg& left, const CompiledLeg& right);
+
+    bool acceptable_combination(const std::vector<Component>& components, std::vector<int>& order,
+                                std::stop_token stop) const override;
+
+    bool check_strike(const CompiledLeg& leg, LegsState& state, double test_strike) const;
+
+    bool check_expiration(const CompiledLeg& leg, LegsState& state, const Date& test_expiration) const;
+
+    bool acceptable_leg(const CompiledLeg& leg, const Component& component, LegsState& state) const;
 
     virtual bool acceptable_type(const std::vector<Component>& components) const override;
     bool acceptable_legs(const std::vector<Component>& components, const std::vector<int>& order) const override;
@@ -83,7 +338,9 @@ protected:
 
 class FixedCombination: public MultipleCombination {
 public:
-    FixedCombination(std::string&& name, std::vector<Leg>&& legs);
+    FixedCombination(CombinationNames&& names, std::vector<Leg>&& legs);
+
+    Cardinality get_cardinality() const override;
 
 private:
     bool acceptable_type(const std::vector<Component>& components) const override;
@@ -91,9 +348,17 @@ private:
 
 class MoreCombination: public Combination {
 public:
-    MoreCombination(std::string&& name, std::size_t&& min_count, std::vector<Leg>&& legs);
+    MoreCombination(CombinationNames&& names, std::size_t&& min_count, std::vector<Leg>&& legs);
+
+    Cardinality get_cardinality() const override;
+    std::size_t get_min_count() const;
+
+    // Whether the rule may accept components with the signature and ratios: enough of them, all of the leg type and
+    // sign, and all of its ratio if it is exact.
+    bool may_accept(const LegsSignature& signature, const RatioHistogram& ratios) const;
 
-    bool acceptable_combination(const std::vector<Component>& components, std::vector<int>& order) const override;
+    bool acceptable_combination(const std::vector<Component>& components, std::vector<int>& order,
+                                std::stop_token stop) const override;
 
 protected:
     std::size_t min_count;
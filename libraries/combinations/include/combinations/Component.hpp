@@ -4,6 +4,7 @@
 #include <ctime>
 #include <istream>
 #include <string>
+#include <string_view>
 
 #include "DateWrap.hpp"
 
@@ -13,6 +14,10 @@ struct Component {
     static Component from_stream(std::istream &);
     static Component from_string(const std::string &);
 
+    // Same format as from_stream, but parsed in place without locale or allocations. On failure the component is
+    // reset to the default one, i.e. of Unknown type, and false is returned.
+    static bool parse(std::string_view, Component &);
+
     InstrumentType type{InstrumentType::Unknown};
     double ratio{0};
     double strike{0};
@@ -0,0 +1,33 @@
+#ifndef COMBINATIONS_COMPONENTBATCH_HPP
+#define COMBINATIONS_COMPONENTBATCH_HPP
+
+#include <cstdint>
+#include <span>
+#include <vector>
+
+#include "Component.hpp"
+
+// Sets of components stored column by column: the instrument types, ratios, strikes and expirations of every leg of
+// the batch are contiguous arrays, and offsets delimit the sets. A scan over one attribute of many sets reads only
+// that attribute, with no padding in between, which lets the compiler vectorize it.
+struct ComponentBatch {
+    ComponentBatch() = default;
+    explicit ComponentBatch(std::span<const std::vector<Component>> batch);
+
+    void push_back(const std::vector<Component>& components);
+    void clear();
+
+    // Number of sets.
+    std::size_t size() const;
+
+    // Copies the set back into components, reusing their storage.
+    void get(std::size_t set, std::vector<Component>& components) const;
+
+    std::vector<InstrumentType> types;
+    std::vector<double> ratios;
+    std::vector<double> strikes;
+    std::vector<std::int32_t> expirations;  // days since epoch
+    std::vector<std::size_t> offsets{0};
+};
+
+#endif  // COMBINATIONS_COMPONENTBATCH_HPP
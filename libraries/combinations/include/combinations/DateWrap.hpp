@@ -1,7 +1,7 @@
 #ifndef COMBINATIONS_DATEWRAP_HPP
 #define COMBINATIONS_DATEWRAP_HPP
 
-#include <array>
+#include <cstdint>
 #include <ctime>
 
 enum class TimePeriods : char { d = 'd', m = 'm', q = 'q', y = 'y' };
@@ -32,8 +32,18 @@ public:
     Date(Date&& date)      = default;
 
     Date(std::tm& date);
+    Date(int year, int month, int day);
 
-    bool check_offset(const ExpirationOffset& offset, const Date& test_date);
+    bool check_offset(const ExpirationOffset& offset, const Date& test_date) const;
+
+    // Number of days of the month, 1 to 12, in the proleptic Gregorian calendar.
+    static int days_in_month(int year, int month);
+
+    std::int32_t days_since_epoch() const;
+    static Date from_days_since_epoch(std::int32_t days);
+
+    // Months since year 0, January being month 0.
+    int months() const;
 
     Date& operator=(const Date& tmp) = default;
     Date& operator=(Date&& tmp)      = default;
@@ -46,13 +56,13 @@ public:
     friend bool operator<=(const Date& left, const Date& right);
 
 private:
-    std::tm date;
-
-    static bool is_leap(std::size_t year);
+    // Number of days since 1970-01-01 in the proleptic Gregorian calendar, so that comparisons and day offsets are
+    // plain integer arithmetic.
+    std::int32_t days{0};
 
-    static std::size_t days_in_month(std::size_t month, std::size_t year);
+    static std::int32_t days_from_civil(int year, int month, int day);
 
-    static Date normalize_date(std::size_t day, std::size_t month, std::size_t year);
+    void to_civil(int& year, int& month, int& day) const;
 };
 
 bool operator==(const Date& left, const Date& right);
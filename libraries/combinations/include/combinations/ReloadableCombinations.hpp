@@ -0,0 +1,68 @@
+#ifndef COMBINATIONS_RELOADABLECOMBINATIONS_HPP
+#define COMBINATIONS_RELOADABLECOMBINATIONS_HPP
+
+#include <atomic>
+#include <condition_variable>
+#include <filesystem>
+#include <memory>
+#include <mutex>
+#include <stop_token>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "Combinations.hpp"
+#include "Component.hpp"
+
+// Rules that can be reloaded from their resource while they are being used. Readers copy the current snapshot and
+// keep it alive for as long as they hold it; a reload builds new rules aside and publishes them at once, so a
+// classification in progress finishes on the rules it started with. Readers never wait for a reload, but taking a
+// snapshot is not lock-free: std::atomic<std::shared_ptr> guards the pointer copy with a short internal spin lock in
+// libstdc++, held only for the reference count update.
+class ReloadableCombinations {
+public:
+    using Snapshot = std::shared_ptr<const Combinations>;
+
+    // Nothing is loaded until the first reload, the rules are empty until then. A compiled resource is read with
+    // Combinations::load_compiled.
+    explicit ReloadableCombinations(std::filesystem::path resource, bool compiled = false);
+
+    ReloadableCombinations(const ReloadableCombinations&)            = delete;
+    ReloadableCombinations& operator=(const ReloadableCombinations&) = delete;
+
+    // Loads the resource on the calling thread. The current rules are kept if it fails.
+    bool reload();
+
+    // Asks the background thread to reload. Requests made while a reload is in progress are merged into one more.
+    void request_reload();
+
+    Snapshot snapshot() const;
+
+    std::string classify(const std::vector<Component>& components, std::vector<int>& order) const;
+
+    // Numbers of successful and failed reloads so far.
+    std::size_t generation() const;
+    std::size_t failures() const;
+
+private:
+    const std::filesystem::path resource;
+    const bool compiled;
+
+    std::atomic<Snapshot> current;
+    std::atomic<std::size_t> loads{0};
+    std::atomic<std::size_t> failed{0};
+
+    // Serializes reloads, so that the last published rules are the last loaded ones.
+    std::mutex load_mutex;
+
+    std::mutex request_mutex;
+    std::condition_variable_any requested;
+    bool pending = false;
+
+    // Last member, so that it is stopped before anything it uses is destroyed.
+    std::jthread reloader;
+
+    void run(std::stop_token stop);
+};
+
+#endif  // COMBINATIONS_RELOADABLECOMBINATIONS_HPP
@@ -0,0 +1,79 @@
+#ifndef COMBINATIONS_RULESTATS_HPP
+#define COMBINATIONS_RULESTATS_HPP
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+// Set by the COMBINATIONS_STATS build option. Otherwise nothing is counted and the counting code is compiled out.
+#ifdef COMBINATIONS_STATS
+inline constexpr bool rule_stats_enabled = true;
+#else
+inline constexpr bool rule_stats_enabled = false;
+#endif
+
+// Work done by one rule on the sets of components it was tried on.
+struct RuleCounters {
+    std::uint64_t attempts     = 0;
+    std::uint64_t type_rejects = 0;  // rejected before any search, by the types and ratios of the components alone
+    std::uint64_t placements   = 0;  // components tried on a leg slot during the search
+    std::uint64_t matches      = 0;
+    std::uint64_t nanoseconds  = 0;
+
+    RuleCounters& operator+=(const RuleCounters& other);
+};
+
+// Counters of a set of rules, kept per thread and summed on demand. A thread only ever writes its own counters, so
+// counting takes neither a lock nor an atomic read-modify-write. When a thread exits, its counters are merged into
+// the totals and its block is freed, so that short lived workers do not pile up blocks.
+class RuleStats {
+public:
+    enum Counter : std::size_t { attempts, type_rejects, placements, matches, nanoseconds, counters };
+
+    explicit RuleStats(std::size_t rules = 0);
+
+    RuleStats(const RuleStats&)            = delete;
+    RuleStats& operator=(const RuleStats&) = delete;
+
+    void add(std::size_t rule, Counter counter, std::uint64_t value);
+
+    // Sums of the counters of every thread, by rule.
+    std::vector<RuleCounters> total() const;
+
+    // Number of running threads with counters of their own.
+    std::size_t threads() const;
+
+    // Resizes the counters to the given number of rules, keeping the counts of the rules that remain. Must not run
+    // concurrently with add.
+    void resize(std::size_t rules);
+
+private:
+    using Block = std::vector<std::array<std::atomic<std::uint64_t>, counters>>;
+
+    // Blocks of the running threads and the sums of the exited ones. The threads keep it by a weak pointer, so that
+    // one exiting after the instance is destroyed does not touch it.
+    struct Shared {
+        std::mutex mutex;
+        std::unordered_map<std::thread::id, std::unique_ptr<Block>> blocks;
+        std::vector<RuleCounters> exited;
+    };
+
+    // Instances the calling thread has a block in, merged into them when it exits.
+    struct ThreadBlocks;
+
+    std::size_t rules;
+    // Unique among all the instances and resets, so that the block a thread cached is never taken for another one.
+    std::uint64_t id;
+    std::shared_ptr<Shared> shared;
+
+    static RuleCounters load(const Block& block, std::size_t rule);
+
+    Block& local();
+};
+
+#endif  // COMBINATIONS_RULESTATS_HPP
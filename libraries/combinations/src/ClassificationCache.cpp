@@ -0,0 +1,157 @@
+#include "combinations/ClassificationCache.hpp"
+
+#include <algorithm>
+#include <bit>
+#include <cstdint>
+#include <functional>
+#include <numeric>
+#include <tuple>
+
+namespace {
+
+// Values are compared by their bits, which orders every double totally, NaN included. A request equal to a cached one
+// in this sense is classified the same way.
+auto key(const Component& component) {
+    return std::make_tuple(component.type, std::bit_cast<std::uint64_t>(component.ratio),
+                           std::bit_cast<std::uint64_t>(component.strike), component.expiration.days_since_epoch());
+}
+
+bool same(const std::vector<Component>& canonical, const std::vector<Component>& components,
+          const std::vector<std::size_t>& positions) {
+    if (canonical.size() != components.size()) {
+        return false;
+    }
+    for (std::size_t i = 0; i < canonical.size(); i++) {
+        if (key(canonical[i]) != key(components[positions[i]])) {
+            return false;
+        }
+    }
+    return true;
+}
+
+}  // anonymous namespace
+
+ClassificationCache::ClassificationCache(const Combinations& combinations, std::size_t capacity, std::size_t shards)
+    : combinations(combinations)
+    , total_capacity(capacity)
+    , shards(std::clamp<std::size_t>(capacity, 1, std::max<std::size_t>(shards, 1))) {
+    for (std::size_t i = 0; i < this->shards.size(); i++) {
+        this->shards[i].capacity = capacity / this->shards.size() + (i < capacity % this->shards.size());
+    }
+}
+
+std::size_t ClassificationCache::capacity() const {
+    return total_capacity;
+}
+
+std::size_t ClassificationCache::size() const {
+    std::size_t size = 0;
+    for (const auto& shard : shards) {
+        std::lock_guard lock(shard.mutex);
+        size += shard.entries.size();
+    }
+    return size;
+}
+
+std::size_t ClassificationCache::hits() const {
+    return hits_count.load(std::memory_order_relaxed);
+}
+
+std::size_t ClassificationCache::misses() const {
+    return misses_count.load(std::memory_order_relaxed);
+}
+
+void ClassificationCache::canonicalize(const std::vector<Component>& components,
+                                       std::vector<std::size_t>& positions) {
+    positions.resize(components.size());
+    std::iota(positions.begin(), positions.end(), 0);
+    std::sort(positions.begin(), positions.end(), [&components](std::size_t left, std::size_t right) {
+        return std::make_tuple(key(components[left]), left) < std::make_tuple(key(components[right]), right);
+    });
+}
+
+std::size_t ClassificationCache::hash(const std::vector<Component>& components,
+                                      const std::vector<std::size_t>& positions) {
+    std::size_t hash   = components.size();
+    const auto combine = [&hash](std::size_t value) { hash ^= value + 0x9e3779b9 + (hash << 6) + (hash >> 2); };
+    for (const auto& it : positions) {
+        const auto& component = components[it];
+        combine(static_cast<std::size_t>(component.type));
+        combine(std::bit_cast<std::uint64_t>(component.ratio));
+        combine(std::bit_cast<std::uint64_t>(component.strike));
+        combine(static_cast<std::size_t>(component.expiration.days_since_epoch()));
+    }
+    return hash;
+}
+
+const Combination* ClassificationCache::match(const std::vector<Component>& components, std::vector<int>& order) {
+    if (!total_capacity) {
+        misses_count.fetch_add(1, std::memory_order_relaxed);
+        return combinations.match(components, order);
+    }
+
+    // positions[i] is the index in components of the i-th one in the canonical order. Kept by the thread, so that a
+    // hit does not allocate.
+    thread_local std::vector<std::size_t> positions;
+    canonicalize(components, positions);
+    const std::size_t key_hash = hash(components, positions);
+    auto& shard                = shards[key_hash % shards.size()];
+
+    {
+        std::lock_guard lock(shard.mutex);
+        const auto [begin, end] = shard.index.equal_range(key_hash);
+        for (auto it = begin; it != end; it++) {
+            const Entry& entry = *it->second;
+            if (!same(entry.components, components, positions)) {
+                continue;
+            }
+
+            shard.entries.splice(shard.entries.begin(), shard.entries, it->second);
+            hits_count.fetch_add(1, std::memory_order_relaxed);
+            if (!entry.rule) {
+                order.clear();
+                return nullptr;
+            }
+            order.resize(components.size());
+            for (std::size_t i = 0; i < positions.size(); i++) {
+                order[positions[i]] = entry.order[i];
+            }
+            return entry.rule;
+        }
+    }
+
+    misses_count.fetch_add(1, std::memory_order_relaxed);
+    const Combination* rule = combinations.match(components, order);
+
+    Entry entry{key_hash, {}, rule, std::vector<int>(components.size())};
+    entry.components.reserve(components.size());
+    for (std::size_t i = 0; i < positions.size(); i++) {
+        entry.components.push_back(components[positions[i]]);
+        if (rule) {
+            entry.order[i] = order[positions[i]];
+        }
+    }
+
+    std::lock_guard lock(shard.mutex);
+    const auto [begin, end] = shard.index.equal_range(key_hash);
+    for (auto it = begin; it != end; it++) {
+        if (same(it->second->components, components, positions)) {
+            return rule;
+        }
+    }
+
+    shard.entries.push_front(std::move(entry));
+    shard.index.emplace(key_hash, shard.entries.begin());
+    while (shard.entries.size() > shard.capacity) {
+        const auto last          = std::prev(shard.entries.end());
+        const auto [first, stop] = shard.index.equal_range(last->hash);
+        for (auto it = first; it != stop; it++) {
+            if (it->second == last) {
+                shard.index.erase(it);
+                break;
+            }
+        }
+        shard.entries.erase(last);
+    }
+    return rule;
+}
@@ -0,0 +1,204 @@
+#include "combinations/ClassifierPool.hpp"
+
+#include <algorithm>
+
+namespace {
+
+// Chunks per worker a batch is cut into, so that stealing can even out uneven chunks.
+constexpr std::size_t chunks_per_worker = 4;
+
+struct Job {
+    ClassifierPool::Batch batch;
+    ClassifiedBatch result;
+    std::atomic<std::size_t> remaining;
+    ClassifierPool::Callback callback;
+};
+
+enum class SearchState : char { pending, rejected, accepted };
+
+// Candidate rules of one request tried in parallel, shared with the tasks since cancelled ones may outlive the call.
+struct RuleSearch {
+    std::vector<Component> components;
+    std::vector<std::size_t> rules;
+    std::vector<std::stop_source> stops;
+    std::vector<std::vector<int>> orders;
+    std::vector<SearchState> states;
+    std::mutex mutex;
+    std::condition_variable decided;
+};
+
+}  // anonymous namespace
+
+ClassifierPool::ClassifierPool(const Combinations& combinations, std::size_t threads)
+    : combinations(combinations), queues(std::max<std::size_t>(threads, 1)) {
+    workers.reserve(queues.size());
+    for (std::size_t i = 0; i < queues.size(); i++) {
+        workers.emplace_back(&ClassifierPool::run, this, i);
+    }
+}
+
+ClassifierPool::~ClassifierPool() {
+    {
+        std::lock_guard lock(sleep_mutex);
+        stopping = true;
+    }
+    sleep.notify_all();
+    for (auto& worker : workers) {
+        worker.join();
+    }
+}
+
+std::size_t ClassifierPool::size() const {
+    return workers.size();
+}
+
+std::future<ClassifiedBatch> ClassifierPool::submit(Batch&& batch) {
+    auto promise = std::make_shared<std::promise<ClassifiedBatch>>();
+    auto future  = promise->get_future();
+    submit(std::move(batch), [promise](ClassifiedBatch&& result) { promise->set_value(std::move(result)); });
+    return future;
+}
+
+void ClassifierPool::submit(Batch&& batch, Callback&& callback) {
+    auto job      = std::make_shared<Job>();
+    job->batch    = std::move(batch);
+    job->callback = std::move(callback);
+    Combinations::prepare_batch(job->batch, job->result);
+
+    if (job->batch.empty()) {
+        job->callback(std::move(job->result));
+        return;
+    }
+
+    const std::size_t chunk  = std::max<std::size_t>(job->batch.size() / (queues.size() * chunks_per_worker), 1);
+    const std::size_t chunks = (job->batch.size() + chunk - 1) / chunk;
+    job->remaining.store(chunks, std::memory_order_relaxed);
+
+    for (std::size_t begin = 0; begin < job->batch.size(); begin += chunk) {
+        push([this, job, begin, end = std::min(begin + chunk, job->batch.size())] {
+            combinations.classify_range(job->batch, job->result, begin, end);
+            if (job->remaining.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+                job->callback(std::move(job->result));
+            }
+        });
+    }
+    wake();
+}
+
+const Combination* ClassifierPool::match(const std::vector<Component>& components, std::vector<int>& order) {
+    if (components.size() < parallel_legs) {
+        return combinations.match(components, order);
+    }
+
+    auto search        = std::make_shared<RuleSearch>();
+    search->components = components;
+    combinations.candidates(components, search->rules);
+    search->stops.resize(search->rules.size());
+    search->orders.resize(search->rules.size());
+    search->states.assign(search->rules.size(), SearchState::pending);
+
+    for (std::size_t i = 0; i < search->rules.size(); i++) {
+        push([this, search, i] {
+            auto& tmp_order = search->orders[i];
+            tmp_order.resize(search->components.size());
+            const bool accepted = combinations.try_rule(search->rules[i], search->components, tmp_order,
+                                                        search->stops[i].get_token());
+
+            {
+                std::lock_guard lock(search->mutex);
+                search->states[i] = accepted ? SearchState::accepted : SearchState::rejected;
+                if (accepted) {
+                    for (std::size_t j = i + 1; j < search->stops.size(); j++) {
+                        search->stops[j].request_stop();
+                    }
+                }
+            }
+            search->decided.notify_all();
+        });
+    }
+    wake();
+
+    // The winner is the first candidate that is not rejected, once it is no longer pending.
+    std::size_t winner = search->rules.size();
+    {
+        std::unique_lock lock(search->mutex);
+        search->decided.wait(lock, [&search, &winner] {
+            const auto it = std::find_if(search->states.begin(), search->states.end(),
+                                         [](SearchState state) { return state != SearchState::rejected; });
+            winner        = it - search->states.begin();
+            return it == search->states.end() || *it == SearchState::accepted;
+        });
+        for (auto& stop : search->stops) {
+            stop.request_stop();
+        }
+    }
+
+    if (winner == search->rules.size()) {
+        order.clear();
+        return nullptr;
+    }
+
+    const auto& tmp_order = search->orders[winner];
+    order.resize(tmp_order.size());
+    for (std::size_t i = 0; i < tmp_order.size(); i++) {
+        order[tmp_order[i]] = static_cast<int>(i + 1);
+    }
+    return combinations.rule(search->rules[winner]);
+}
+
+void ClassifierPool::push(Task&& task) {
+    auto& queue = queues[next_queue.fetch_add(1, std::memory_order_relaxed) % queues.size()];
+
+    std::lock_guard lock(queue.mutex);
+    queue.tasks.push_back(std::move(task));
+    queued.fetch_add(1, std::memory_order_release);
+}
+
+void ClassifierPool::wake() {
+    {
+        std::lock_guard lock(sleep_mutex);
+    }
+    sleep.notify_all();
+}
+
+bool ClassifierPool::take(std::size_t self, Task& task) {
+    {
+        auto& queue = queues[self];
+        std::lock_guard lock(queue.mutex);
+        if (!queue.tasks.empty()) {
+            task = std::move(queue.tasks.back());
+            queue.tasks.pop_back();
+            queued.fetch_sub(1, std::memory_order_relaxed);
+            return true;
+        }
+    }
+
+    for (std::size_t i = 1; i < queues.size(); i++) {
+        auto& queue = queues[(self + i) % queues.size()];
+        std::lock_guard lock(queue.mutex);
+        if (!queue.tasks.empty()) {
+            task = std::move(queue.tasks.front());
+            queue.tasks.pop_front();
+            queued.fetch_sub(1, std::memory_order_relaxed);
+            return true;
+        }
+    }
+    return false;
+}
+
+void ClassifierPool::run(std::size_t self) {
+    Task task;
+    while (true) {
+        if (take(self, task)) {
+            task();
+            task = nullptr;
+            continue;
+        }
+
+        std::unique_lock lock(sleep_mutex);
+        sleep.wait(lock, [this] { return stopping || queued.load(std::memory_order_acquire); });
+        if (stopping && !queued.load(std::memory_order_acquire)) {
+            return;
+        }
+    }
+}
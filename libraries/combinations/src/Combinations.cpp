@@ -1,19 +1,414 @@
 #include "combinations/Combinations.hpp"
 
-Combination::Combination(std::string&& name, std::vector<Leg>&& legs) : name(std::move(name)), legs(std::move(legs)) {}
+#include <bit>
+#include <chrono>
+#include <cmath>
+#include <optional>
 
-std::string Combination::get_name() const {
-    return name;
+#if defined(__AVX2__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+namespace {
+
+const std::string unclassified_name = "Unclassified";
+
+// What the last rule tried by the calling thread did, for RuleStats.
+struct SearchCounters {
+    std::uint64_t placements = 0;
+    bool type_rejected       = false;
+};
+
+thread_local SearchCounters search_counters;
+
+// Temporaries of the classifications run by the calling thread. They are only ever resized, and so grow to the largest
+// request seen, after which a classification does not allocate.
+struct Scratch {
+    std::vector<int> order;
+    std::vector<Component> components;
+};
+
+thread_local Scratch scratch;
+
+std::size_t type_index(InstrumentType type) {
+    switch (type) {
+    case InstrumentType::C:
+        return 0;
+    case InstrumentType::F:
+        return 1;
+    case InstrumentType::O:
+        return 2;
+    case InstrumentType::P:
+        return 3;
+    case InstrumentType::U:
+        return 4;
+    case InstrumentType::Unknown:
+        [[fallthrough]];
+    default:
+        return 5;
+    }
+}
+
+// Position of the type and ratio in RatioHistogram, or -1 if it is not counted.
+int ratio_class(InstrumentType type, double ratio) {
+    constexpr int max_ratio    = static_cast<int>(RatioHistogram::max_ratio);
+    const std::size_t type_pos = type_index(type);
+    if (type_pos == type_index(InstrumentType::Unknown) || !(std::abs(ratio) <= max_ratio)) {
+        return -1;
+    }
+    const int value = static_cast<int>(ratio);
+    if (value != ratio || !value) {
+        return -1;
+    }
+    return static_cast<int>(type_pos) * 2 * max_ratio + (value < 0 ? value + max_ratio : value + max_ratio - 1);
+}
+
+template <typename Index>
+const std::vector<std::size_t>& find_rules(const Index& index, const LegsSignature& signature) {
+    static const std::vector<std::size_t> no_rules;
+
+    const auto it = index.find(signature);
+    return it == index.end() ? no_rules : it->second;
+}
+
+// Runs classify(begin, end) over ranges of the given size split between the given number of threads.
+template <typename Classify>
+void split_between_threads(std::size_t size, std::size_t threads, Classify&& classify) {
+    threads = std::min(threads, size);
+    if (threads <= 1) {
+        classify(0, size);
+        return;
+    }
+
+    std::vector<std::thread> workers;
+    workers.reserve(threads);
+    const std::size_t chunk = (size + threads - 1) / threads;
+    for (std::size_t begin = 0; begin < size; begin += chunk) {
+        workers.emplace_back(classify, begin, std::min(begin + chunk, size));
+    }
+    for (auto& worker : workers) {
+        worker.join();
+    }
+}
+
+// Finds a component for slot among the ones not visited yet, moving the owners of taken ones to other components.
+bool augment(std::size_t slot, std::span<const std::uint64_t> slots, std::array<int, 64>& owners,
+             std::uint64_t& visited) {
+    for (std::uint64_t free = slots[slot] & ~visited; free; free = slots[slot] & ~visited) {
+        const int component = std::countr_zero(free);
+        visited |= std::uint64_t{1} << component;
+        if (owners[component] < 0 || augment(owners[component], slots, owners, visited)) {
+            owners[component] = static_cast<int>(slot);
+            return true;
+        }
+    }
+    return false;
+}
+
+// Whether every slot can be given a distinct component, slots[i] being the mask of the components slot i accepts.
+bool perfect_matching(std::span<const std::uint64_t> slots) {
+    std::array<int, 64> owners;
+    owners.fill(-1);
+    for (std::size_t slot = 0; slot < slots.size(); slot++) {
+        std::uint64_t visited = 0;
+        if (!augment(slot, slots, owners, visited)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Components whose value is equal to (direction 0), above (direction > 0) or below (direction < 0) the given one.
+// values are sorted in increasing order, from[r] is the mask of the components of rank r and above.
+template <typename T>
+std::uint64_t value_range(std::span<const T> values, std::span<const std::uint64_t> from, T value, int direction,
+                          std::uint64_t all) {
+    const std::size_t lower = std::lower_bound(values.begin(), values.end(), value) - values.begin();
+    const std::size_t upper = std::upper_bound(values.begin() + lower, values.end(), value) - values.begin();
+    if (direction > 0) {
+        return from[upper];
+    }
+    if (direction < 0) {
+        return all & ~from[lower];
+    }
+    return from[lower] & ~from[upper];
+}
+
+// Removes count groups starting in the month keys[first] from counts, each group taking the months offsets after it.
+// keys are the distinct months in increasing order.
+bool take_groups(std::span<const int> keys, std::span<int> counts, std::span<const int> offsets, std::size_t first,
+                 int count) {
+    for (const int offset : offsets) {
+        const auto it = std::lower_bound(keys.begin() + first, keys.end(), keys[first] + offset);
+        if (it == keys.end() || *it != keys[first] + offset || counts[it - keys.begin()] < count) {
+            return false;
+        }
+        counts[it - keys.begin()] -= count;
+    }
+    counts[first] -= count;
+    return true;
+}
+
+// Whether the months counted in counts split into groups. Offsets are positive, so the earliest month left can only
+// start a group, and all of its components start one.
+bool splittable(std::span<const int> keys, std::span<int> counts, std::span<const int> offsets) {
+    for (std::size_t key = 0; key < keys.size(); key++) {
+        if (counts[key] && !take_groups(keys, counts, offsets, key, counts[key])) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Writes the inverse of tmp_order, 1-based, into order.
+void write_order(const std::vector<int>& tmp_order, int* order) {
+    for (std::size_t j = 0; j < tmp_order.size(); j++) {
+        order[tmp_order[j]] = static_cast<int>(j + 1);
+    }
+}
+
+// Rule read from a resource, kept until the whole resource is read.
+struct Rule {
+    Cardinality cardinality;
+    std::size_t min_count;
+    CombinationNames names;
+    std::vector<Leg> legs;
+};
+
+}  // anonymous namespace
+
+Combination::Combination(CombinationNames&& names, std::vector<Leg>&& legs)
+    : names(std::move(names)), legs(std::move(legs)) {}
+
+const std::string& Combination::get_name() const {
+    return names.name;
+}
+
+const std::string& Combination::get_shortname() const {
+    return names.shortname;
+}
+
+const std::string& Combination::get_identifier() const {
+    return names.identifier;
+}
+
+const std::vector<Leg>& Combination::get_legs() const {
+    return legs;
+}
+
+MultipleCombination::MultipleCombination(CombinationNames&& names, std::vector<Leg>&& legs)
+    : Combination(std::move(names), std::move(legs)), program(compile(Combination::legs)) {
+    for (const auto& it : program) {
+        types_mask |= 1u << type_index(it.type);
+        ordered_values |= it.strike_check == ValueCheck::bind || it.expiration_check == ValueCheck::bind ||
+                          (it.strike_check == ValueCheck::offset && it.strike_arg) ||
+                          (it.expiration_check == ValueCheck::offset && it.expiration_arg);
+    }
+    group_offsets = quarterly_offsets(program);
+}
+
+FixedCombination::FixedCombination(CombinationNames&& names, std::vector<Leg>&& legs)
+    : MultipleCombination(std::move(names), std::move(legs)) {
+    if (program.size() > inline_size) {
+        return;
+    }
+    for (std::size_t i = 0; i < program.size(); i++) {
+        bool forced = true;
+        for (std::size_t j = 0; j < program.size() && forced; j++) {
+            forced = i == j || !overlap(program[i], program[j]);
+        }
+        forced_legs |= static_cast<std::uint32_t>(forced) << i;
+    }
+}
+
+MoreCombination::MoreCombination(CombinationNames&& names, std::size_t&& min_count, std::vector<Leg>&& legs)
+    : Combination(std::move(names), std::move(legs)), min_count(min_count) {}
+
+Cardinality MultipleCombination::get_cardinality() const {
+    return Cardinality::multiple;
+}
+
+Cardinality FixedCombination::get_cardinality() const {
+    return Cardinality::fixed;
+}
+
+Cardinality MoreCombination::get_cardinality() const {
+    return Cardinality::more;
+}
+
+std::size_t MoreCombination::get_min_count() const {
+    return min_count;
+}
+
+bool MoreCombination::may_accept(const LegsSignature& signature, const RatioHistogram& ratios) const {
+    const std::size_t size = signature.positive + signature.negative;
+    if (size < min_count) {
+        return false;
+    }
+    // Without a leg no component is accepted.
+    if (legs.empty()) {
+        return !size;
+    }
+    const Leg& leg = legs[0];
+
+    // An option leg also takes calls and puts.
+    const std::array<InstrumentType, 3> types{leg.type, InstrumentType::C, InstrumentType::P};
+    const std::size_t type_count = leg.type == InstrumentType::O ? types.size() : 1;
+
+    std::size_t typed = 0;
+    for (std::size_t i = 0; i < type_count; i++) {
+        typed += signature.types[type_index(types[i])];
+    }
+    if (typed != size) {
+        return false;
+    }
+
+    if (std::holds_alternative<char>(leg.ratio)) {
+        return (std::get<char>(leg.ratio) == '+' ? signature.negative : signature.positive) == 0;
+    }
+    // Ratios outside the histogram and saturated counts are left to the search.
+    const double ratio = std::get<double>(leg.ratio);
+    if (ratio_class(leg.type, ratio) < 0 || size >= std::numeric_limits<std::uint8_t>::max()) {
+        return true;
+    }
+    std::size_t exact = 0;
+    for (std::size_t i = 0; i < type_count; i++) {
+        exact += ratios.counts[ratio_class(types[i], ratio)];
+    }
+    return exact == size;
+}
+
+LegsSignature LegsSignature::of(const std::vector<Leg>& legs) {
+    LegsSignature signature;
+    for (const auto& leg : legs) {
+        signature.types[type_index(leg.type)]++;
+
+        const bool positive = std::holds_alternative<char>(leg.ratio) ? std::get<char>(leg.ratio) == '+'
+                                                                      : std::get<double>(leg.ratio) > 0;
+        (positive ? signature.positive : signature.negative)++;
+    }
+    return signature;
+}
+
+LegsSignature LegsSignature::of(const std::vector<Component>& components) {
+    LegsSignature signature;
+    for (const auto& component : components) {
+        signature.types[type_index(component.type)]++;
+        (component.ratio > 0 ? signature.positive : signature.negative)++;
+    }
+    return signature;
+}
+
+LegsSignature LegsSignature::of(const ComponentBatch& batch, std::size_t set) {
+    static constexpr std::array<InstrumentType, 5> known_types{InstrumentType::C, InstrumentType::F,
+                                                               InstrumentType::O, InstrumentType::P, InstrumentType::U};
+
+    const std::size_t begin = batch.offsets[set];
+    const std::size_t end   = batch.offsets[set + 1];
+
+    // One pass per type and one for the signs, each a plain count over a column.
+    LegsSignature signature;
+    std::size_t known = 0;
+    for (std::size_t i = 0; i < known_types.size(); i++) {
+        signature.types[type_index(known_types[i])] =
+            std::count(batch.types.begin() + begin, batch.types.begin() + end, known_types[i]);
+        known += signature.types[type_index(known_types[i])];
+    }
+    signature.types[type_index(InstrumentType::Unknown)] = end - begin - known;
+
+    for (std::size_t i = begin; i < end; i++) {
+        signature.positive += batch.ratios[i] > 0;
+    }
+    signature.negative = end - begin - signature.positive;
+    return signature;
+}
+
+LegsSignature LegsSignature::reduced() const {
+    std::size_t divisor = std::gcd(positive, negative);
+    for (const auto& it : types) {
+        divisor = std::gcd(divisor, it);
+    }
+    if (!divisor) {
+        return *this;
+    }
+
+    LegsSignature signature;
+    for (std::size_t i = 0; i < types.size(); i++) {
+        signature.types[i] = types[i] / divisor;
+    }
+    signature.positive = positive / divisor;
+    signature.negative = negative / divisor;
+    return signature;
 }
 
-MultipleCombination::MultipleCombination(std::string&& name, std::vector<Leg>&& legs)
-    : Combination(std::move(name), std::move(legs)) {}
+RatioHistogram RatioHistogram::of(const std::vector<Leg>& legs) {
+    RatioHistogram histogram;
+    for (const auto& leg : legs) {
+        if (!std::holds_alternative<double>(leg.ratio)) {
+            continue;
+        }
+        const int pos = ratio_class(leg.type, std::get<double>(leg.ratio));
+        if (pos >= 0 && histogram.counts[pos] < std::numeric_limits<std::uint8_t>::max()) {
+            histogram.counts[pos]++;
+        }
+    }
+    return histogram;
+}
+
+RatioHistogram RatioHistogram::of(const std::vector<Component>& components) {
+    RatioHistogram histogram;
+    for (const auto& component : components) {
+        const int pos = ratio_class(component.type, component.ratio);
+        if (pos >= 0 && histogram.counts[pos] < std::numeric_limits<std::uint8_t>::max()) {
+            histogram.counts[pos]++;
+        }
+    }
+    return histogram;
+}
+
+RatioHistogram RatioHistogram::of(const ComponentBatch& batch, std::size_t set) {
+    RatioHistogram histogram;
+    for (std::size_t i = batch.offsets[set]; i < batch.offsets[set + 1]; i++) {
+        const int pos = ratio_class(batch.types[i], batch.ratios[i]);
+        if (pos >= 0 && histogram.counts[pos] < std::numeric_limits<std::uint8_t>::max()) {
+            histogram.counts[pos]++;
+        }
+    }
+    return histogram;
+}
 
-FixedCombination::FixedCombination(std::string&& name, std::vector<Leg>&& legs)
-    : MultipleCombination(std::move(name), std::move(legs)) {}
+bool RatioHistogram::covers(const RatioHistogram& rule) const {
+    // Every count is at least the rule one exactly if taking the maximum of both changes nothing.
+#if defined(__AVX2__)
+    const __m256i own   = _mm256_load_si256(reinterpret_cast<const __m256i*>(counts.data()));
+    const __m256i other = _mm256_load_si256(reinterpret_cast<const __m256i*>(rule.counts.data()));
+    return _mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_max_epu8(own, other), own)) == -1;
+#elif defined(__SSE2__)
+    for (std::size_t i = 0; i < counts.size(); i += 16) {
+        const __m128i own   = _mm_load_si128(reinterpret_cast<const __m128i*>(counts.data() + i));
+        const __m128i other = _mm_load_si128(reinterpret_cast<const __m128i*>(rule.counts.data() + i));
+        if (_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_max_epu8(own, other), own)) != 0xFFFF) {
+            return false;
+        }
+    }
+    return true;
+#else
+    for (std::size_t i = 0; i < counts.size(); i++) {
+        if (counts[i] < rule.counts[i]) {
+            return false;
+        }
+    }
+    return true;
+#endif
+}
 
-MoreCombination::MoreCombination(std::string&& name, std::size_t&& min_count, std::vector<Leg>&& legs)
-    : Combination(std::move(name), std::move(legs)), min_count(min_count) {}
+std::size_t LegsSignatureHash::operator()(const LegsSignature& signature) const {
+    std::size_t hash = signature.positive * 31 + signature.negative;
+    for (const auto& it : signature.types) {
+        hash = hash * 31 + it;
+    }
+    return hash;
+}
 
 void Combinations::set_ratio(pugi::xml_node& leg_xml, Leg& leg) {
     const auto& ratio = leg_xml.attribute("ratio");
@@ -101,177 +496,696 @@ bool Combinations::load(const std::filesystem::path& resource) {
         return false;
     }
 
+    // Rules are added only once every rule of the resource is known to be accepted by add_rule, so that a rule with
+    // too many symbols leaves the loaded rules untouched
+    std::vector<Rule> rules;
     for (pugi::xml_node curr_comb : comb.children("combination")) {
         pugi::xml_node legs_xml      = curr_comb.child("legs");
         std::vector<Leg> legs        = parse_legs(legs_xml);
         const auto& legs_cardinality = legs_xml.attribute("cardinality").value();
-        std::string name             = curr_comb.attribute("name").value();
+        CombinationNames names{curr_comb.attribute("name").value(), curr_comb.attribute("shortname").value(),
+                               curr_comb.attribute("identifier").value()};
 
+        Cardinality cardinality;
         if (!std::strcmp(legs_cardinality, "fixed")) {
-            combinations.emplace_back(std::make_unique<FixedCombination>(std::move(name), std::move(legs)));
-        }
-        if (!std::strcmp(legs_cardinality, "multiple")) {
-            combinations.emplace_back(std::make_unique<MultipleCombination>(std::move(name), std::move(legs)));
+            cardinality = Cardinality::fixed;
+        } else if (!std::strcmp(legs_cardinality, "multiple")) {
+            cardinality = Cardinality::multiple;
+        } else if (!std::strcmp(legs_cardinality, "more")) {
+            cardinality = Cardinality::more;
+        } else {
+            continue;
         }
-        if (!std::strcmp(legs_cardinality, "more")) {
-            combinations.emplace_back(std::make_unique<MoreCombination>(
-                std::move(name), legs_xml.attribute("mincount").as_uint(), std::move(legs)));
+
+        if (cardinality != Cardinality::more && !MultipleCombination::supports(legs)) {
+            return false;
         }
+        rules.push_back({cardinality, legs_xml.attribute("mincount").as_uint(), std::move(names), std::move(legs)});
     }
 
+    for (Rule& rule : rules) {
+        add_rule(rule.cardinality, std::move(rule.names), rule.min_count, std::move(rule.legs));
+    }
+    size_stats();
     return true;
 }
 
-bool MultipleCombination::acceptable_combination(const std::vector<Component>& components,
-                                                 std::vector<int>& order) const {
-    if (!acceptable_type(components)) {
+bool Combinations::add_rule(Cardinality cardinality, CombinationNames&& names, std::size_t min_count,
+                            std::vector<Leg>&& legs) {
+    if (cardinality != Cardinality::more && !MultipleCombination::supports(legs)) {
         return false;
     }
 
-    std::iota(order.begin(), order.end(), 0);
-    do {
-        if (acceptable_legs(components, order)) {
-            return true;
+    const LegsSignature signature = LegsSignature::of(legs);
+
+    switch (cardinality) {
+    case Cardinality::fixed:
+        fixed_index[signature].push_back(combinations.size());
+        combinations.emplace_back(std::make_unique<FixedCombination>(std::move(names), std::move(legs)));
+        break;
+    case Cardinality::multiple:
+        multiple_index[signature.reduced()].push_back(combinations.size());
+        combinations.emplace_back(std::make_unique<MultipleCombination>(std::move(names), std::move(legs)));
+        break;
+    case Cardinality::more:
+        more_index.push_back(combinations.size());
+        combinations.emplace_back(
+            std::make_unique<MoreCombination>(std::move(names), std::move(min_count), std::move(legs)));
+        break;
+    }
+
+    // A more rule applies its legs to every component rather than taking one component per leg
+    ratio_histograms.push_back(cardinality == Cardinality::more ? RatioHistogram()
+                                                                : RatioHistogram::of(combinations.back()->get_legs()));
+    return true;
+}
+
+void Combinations::size_stats() {
+    if constexpr (rule_stats_enabled) {
+        if (!rule_stats) {
+            rule_stats = std::make_unique<RuleStats>(combinations.size());
+        } else {
+            rule_stats->resize(combinations.size());
         }
-    } while (std::next_permutation(order.begin(), order.end()));
+    }
+}
 
-    return false;
+bool MultipleCombination::supports(const std::vector<Leg>& legs) {
+    std::unordered_set<char> strikes;
+    std::unordered_set<char> expirations;
+    for (const auto& leg : legs) {
+        if (std::holds_alternative<char>(leg.strike) && std::get<char>(leg.strike) != Leg::invalid_strike) {
+            strikes.insert(std::get<char>(leg.strike));
+        }
+        if (std::holds_alternative<char>(leg.expiration) &&
+            std::get<char>(leg.expiration) != Leg::invalid_expiration) {
+            expirations.insert(std::get<char>(leg.expiration));
+        }
+    }
+    return strikes.size() <= max_symbols && expirations.size() <= max_symbols;
 }
 
-bool MultipleCombination::acceptable_type(const std::vector<Component>& components) const {
-    if (components.empty() || components.size() % legs.size()) {
+std::vector<MultipleCombination::CompiledLeg> MultipleCombination::compile(const std::vector<Leg>& legs) {
+    std::vector<char> strike_symbols;
+    std::vector<char> expiration_symbols;
+    const auto slot = [](std::vector<char>& symbols, char symb) {
+        const auto it = std::find(symbols.begin(), symbols.end(), symb);
+        if (it != symbols.end()) {
+            return static_cast<int>(it - symbols.begin());
+        }
+        symbols.push_back(symb);
+        return static_cast<int>(symbols.size() - 1);
+    };
+
+    std::vector<CompiledLeg> program;
+    program.reserve(legs.size());
+    for (const auto& leg : legs) {
+        CompiledLeg compiled{};
+        compiled.type = leg.type;
+
+        if (std::holds_alternative<double>(leg.ratio)) {
+            compiled.ratio_check = RatioCheck::exact;
+            compiled.ratio       = std::get<double>(leg.ratio);
+        } else {
+            compiled.ratio_check = std::get<char>(leg.ratio) == '+' ? RatioCheck::positive : RatioCheck::negative;
+        }
+
+        if (std::holds_alternative<int>(leg.strike)) {
+            compiled.strike_check = ValueCheck::offset;
+            compiled.strike_arg   = std::get<int>(leg.strike);
+        } else if (std::get<char>(leg.strike) != Leg::invalid_strike) {
+            compiled.strike_check = ValueCheck::bind;
+            compiled.strike_arg   = slot(strike_symbols, std::get<char>(leg.strike));
+        } else {
+            compiled.strike_check = ValueCheck::none;
+        }
+
+        if (std::holds_alternative<ExpirationOffset>(leg.expiration)) {
+            compiled.expiration_check  = ValueCheck::period;
+            compiled.expiration_period = std::get<ExpirationOffset>(leg.expiration);
+        } else if (std::holds_alternative<int>(leg.expiration)) {
+            compiled.expiration_check = ValueCheck::offset;
+            compiled.expiration_arg   = std::get<int>(leg.expiration);
+        } else if (std::get<char>(leg.expiration) != Leg::invalid_expiration) {
+            compiled.expiration_check = ValueCheck::bind;
+            compiled.expiration_arg   = slot(expiration_symbols, std::get<char>(leg.expiration));
+        } else {
+            compiled.expiration_check = ValueCheck::none;
+        }
+
+        program.push_back(compiled);
+    }
+    return program;
+}
+
+bool MultipleCombination::acceptable_combination(const std::vector<Component>& components, std::vector<int>& order,
+                                                 std::stop_token stop) const {
+    if (!acceptable_type(components)) {
+        if constexpr (rule_stats_enabled) {
+            search_counters.type_rejected = true;
+        }
         return false;
     }
 
-    std::unordered_set<InstrumentType> legs_type;
+    if (!group_offsets.empty()) {
+        return partition(components, order, stop);
+    }
 
-    for (const auto& it : legs) {
-        legs_type.insert(it.type);
+    if (components.size() < masked_size || components.size() > max_masked_size) {
+        return search(components, order, stop);
     }
 
-    for (const auto& it : components) {
-        if (!legs_type.contains(it.type)) {
+    LegsMasks legs_masks{};
+    if (!feasible(components, legs_masks)) {
+        if constexpr (rule_stats_enabled) {
+            search_counters.type_rejected = true;
+        }
+        return false;
+    }
+    return search_masked(components, order, stop, legs_masks);
+}
+
+std::vector<int> MultipleCombination::quarterly_offsets(const std::vector<CompiledLeg>& program) {
+    if (program.size() < 2) {
+        return {};
+    }
+    const CompiledLeg& first = program.front();
+    if (first.strike_check != ValueCheck::none || first.expiration_check != ValueCheck::none) {
+        return {};
+    }
+
+    std::vector<int> offsets;
+    for (std::size_t i = 1; i < program.size(); i++) {
+        const CompiledLeg& leg = program[i];
+        if (leg.type != first.type || leg.ratio_check != first.ratio_check ||
+            (leg.ratio_check == RatioCheck::exact && leg.ratio != first.ratio) ||
+            leg.strike_check != ValueCheck::none || leg.expiration_check != ValueCheck::period ||
+            leg.expiration_period.per() != TimePeriods::q || !leg.expiration_period.num()) {
+            return {};
+        }
+        offsets.push_back(static_cast<int>(leg.expiration_period.num()) * 3);
+    }
+    return offsets;
+}
+
+bool MultipleCombination::partition(const std::vector<Component>& components, std::vector<int>& order,
+                                    std::stop_token stop) const {
+    // Every leg takes the same components, and the month of the first leg of a group fixes the months of the others.
+    // Components of the same month are thus interchangeable, and of two of them the search always takes the lower
+    // index first. So the first leg of each group gets the lowest unused component whose month leaves the rest
+    // splittable into groups, and every other leg the lowest unused one of its month: the assignment the search
+    // would find, without trying the others.
+    const std::size_t size = components.size();
+    const std::size_t legs = program.size();
+
+    thread_local std::vector<int> months;
+    thread_local std::vector<int> keys;
+    thread_local std::vector<int> counts;
+    thread_local std::vector<int> remaining;
+    thread_local std::vector<std::size_t> key_of;
+    thread_local std::vector<std::size_t> members;
+    thread_local std::vector<std::size_t> next_member;
+    thread_local std::vector<std::size_t> rejected;
+    thread_local std::vector<char> used;
+
+    months.resize(size);
+    for (std::size_t i = 0; i < size; i++) {
+        if (!accepts_ratio(program.front(), components[i])) {
+            if constexpr (rule_stats_enabled) {
+                search_counters.type_rejected = true;
+            }
+            return false;
+        }
+        months[i] = components[i].expiration.months();
+    }
+
+    // Components sorted by month then index, the ones of keys[k] starting at next_member[k].
+    members.resize(size);
+    std::iota(members.begin(), members.end(), 0);
+    std::sort(members.begin(), members.end(), [](std::size_t left, std::size_t right) {
+        return months[left] < months[right] || (months[left] == months[right] && left < right);
+    });
+    keys.clear();
+    next_member.clear();
+    for (std::size_t rank = 0; rank < size; rank++) {
+        if (keys.empty() || keys.back() != months[members[rank]]) {
+            keys.push_back(months[members[rank]]);
+            next_member.push_back(rank);
+        }
+    }
+    counts.assign(keys.size(), 0);
+    key_of.resize(size);
+    for (std::size_t i = 0; i < size; i++) {
+        key_of[i] = std::lower_bound(keys.begin(), keys.end(), months[i]) - keys.begin();
+        counts[key_of[i]]++;
+    }
+
+    remaining.assign(counts.begin(), counts.end());
+    if (!splittable(keys, remaining, group_offsets)) {
+        if constexpr (rule_stats_enabled) {
+            search_counters.type_rejected = true;
+        }
+        return false;
+    }
+
+    // rejected[k] is the group which the month keys[k] can not start, plus one.
+    used.assign(size, 0);
+    rejected.assign(keys.size(), 0);
+    std::size_t lowest = 0;
+    for (std::size_t group = 0; group * legs < size; group++) {
+        if (stop.stop_requested()) {
             return false;
         }
+
+        while (used[lowest]) {
+            lowest++;
+        }
+        std::size_t first = lowest;
+        for (; first < size; first++) {
+            if (used[first] || rejected[key_of[first]] == group + 1) {
+                continue;
+            }
+            if constexpr (rule_stats_enabled) {
+                search_counters.placements++;
+            }
+            remaining.assign(counts.begin(), counts.end());
+            if (take_groups(keys, remaining, group_offsets, key_of[first], 1) &&
+                splittable(keys, remaining, group_offsets)) {
+                break;
+            }
+            rejected[key_of[first]] = group + 1;
+        }
+        if (first == size) {
+            return false;
+        }
+
+        take_groups(keys, counts, group_offsets, key_of[first], 1);
+        for (std::size_t leg = 0; leg < legs; leg++) {
+            const std::size_t key =
+                leg ? std::lower_bound(keys.begin(), keys.end(), keys[key_of[first]] + group_offsets[leg - 1]) -
+                          keys.begin()
+                    : key_of[first];
+            const std::size_t component = members[next_member[key]++];
+            used[component]             = true;
+            order[group * legs + leg]   = static_cast<int>(component);
+        }
     }
 
     return true;
 }
 
-bool MultipleCombination::check_strike(const std::variant<char, int>& leg_strike,
-                                       std::unordered_map<char, double>& strikes, double& last_strike,
-                                       std::size_t& last_signs_amount, const double& test_strike) const {
-    if (std::holds_alternative<char>(leg_strike)) {
-        const auto& symb = std::get<char>(leg_strike);
-        if (symb == Leg::invalid_strike) {
-            last_strike       = test_strike;
-            last_signs_amount = 0;
-            return true;
+bool MultipleCombination::search(const std::vector<Component>& components, std::vector<int>& order,
+                                 std::stop_token stop) const {
+    // Components are assigned to the leg slots one by one, always trying the unused ones in increasing index order,
+    // and a branch is dropped as soon as its last leg fails. Thus the first complete assignment is the
+    // lexicographically smallest acceptable permutation, the same one std::next_permutation would stop at.
+    // states[pos] is the state before the leg pos is assigned.
+    const std::size_t size = components.size();
+
+    // Larger requests use buffers of the calling thread, kept for the next ones.
+    std::array<LegsState, inline_size + 1> inline_states;
+    std::array<char, inline_size> inline_used{};
+    thread_local std::vector<LegsState> heap_states;
+    thread_local std::vector<char> heap_used;
+    if (size > inline_size) {
+        heap_states.resize(std::max(heap_states.size(), size + 1));
+        heap_used.assign(size, 0);
+    }
+    const std::span<LegsState> states =
+        size > inline_size ? std::span(heap_states).first(size + 1) : std::span(inline_states);
+    const std::span<char> used        = size > inline_size ? std::span(heap_used) : std::span(inline_used);
+
+    // Component of each forced leg, looked up on the first visit of its slot. It must be the only one the leg
+    // accepts, any other would be left without a leg.
+    std::array<std::size_t, inline_size> forced;
+    std::uint32_t resolved = 0;
+
+    states[0]             = LegsState();
+    std::size_t pos       = 0;
+    std::size_t candidate = 0;
+    while (pos < size) {
+        if (stop.stop_requested()) {
+            return false;
         }
-        if (strikes.contains(symb)) {
-            const auto& it = strikes.find(symb);
-            if (it->second != test_strike) {
-                return false;
+
+        const auto& leg = program[pos % program.size()];
+
+        if (pos && !(pos % program.size()) && !candidate) {
+            const Date last_expiration  = states[pos].last_expiration;
+            states[pos]                 = LegsState();
+            states[pos].last_expiration = last_expiration;
+        }
+
+        // The other candidates of a forced leg would all fail its type or ratio check.
+        std::size_t last = size;
+        if (pos < inline_size && forced_legs >> pos & 1) {
+            if (!(resolved >> pos & 1)) {
+                std::size_t accepted = 0;
+                for (std::size_t i = 0; i < size; i++) {
+                    if (accepts_ratio(leg, components[i])) {
+                        forced[pos] = i;
+                        accepted++;
+                    }
+                }
+                if (accepted != 1) {
+                    return false;
+                }
+                resolved |= 1u << pos;
             }
-        } else {
-            strikes.insert({symb, test_strike});
+            candidate = std::max(candidate, forced[pos]);
+            last      = std::min(size, forced[pos] + 1);
         }
-        last_signs_amount = 0;
-    } else if (std::holds_alternative<int>(leg_strike)) {
-        const auto& strike_offset = std::get<int>(leg_strike);
-        if (strike_offset != 0 && strike_offset == static_cast<int>(last_signs_amount)) {
-            if (test_strike != last_strike) {
-                return false;
+
+        bool placed = false;
+        for (; candidate < last; candidate++) {
+            if (used[candidate]) {
+                continue;
             }
-        } else if ((strike_offset > 0 && test_strike <= last_strike) ||
-                   (strike_offset < 0 && test_strike >= last_strike)) {
+            if constexpr (rule_stats_enabled) {
+                search_counters.placements++;
+            }
+            states[pos + 1] = states[pos];
+            if (acceptable_leg(leg, components[candidate], states[pos + 1])) {
+                used[candidate] = true;
+                order[pos++]    = static_cast<int>(candidate);
+                placed          = true;
+                break;
+            }
+        }
+
+        if (placed) {
+            candidate = 0;
+            continue;
+        }
+        if (!pos) {
             return false;
         }
-        last_signs_amount = strike_offset;
+
+        pos--;
+        used[order[pos]] = false;
+        candidate        = order[pos] + 1;
     }
-    last_strike = test_strike;
+
     return true;
 }
 
-bool MultipleCombination::check_expiration(const std::variant<char, int, ExpirationOffset>& leg_expiration,
-                                           std::unordered_map<char, Date>& expirations, Date& last_expiration,
-                                           std::size_t& last_signs_amount, const Date& test_expiration) const {
-    if (std::holds_alternative<char>(leg_expiration)) {
-        const auto& symb = std::get<char>(leg_expiration);
-        if (symb == Leg::invalid_expiration) {
-            last_expiration   = test_expiration;
-            last_signs_amount = 0;
-            return true;
+bool MultipleCombination::search_masked(const std::vector<Component>& components, std::vector<int>& order,
+                                        std::stop_token stop, const LegsMasks& legs_masks) const {
+    // Same search as the above, but the candidates of a slot are the unused components passing the type, ratio and
+    // value order checks of its leg, taken from the masks in increasing index order. The others would fail the leg
+    // anyway, so the first assignment found is the same.
+    const std::size_t size = components.size();
+    std::optional<SortedComponents> sorted;
+    if (ordered_values) {
+        sorted.emplace(components);
+    }
+
+    thread_local std::vector<LegsState> states;
+    states.resize(std::max(states.size(), size + 1));
+
+    states[0]             = LegsState();
+    std::uint64_t unused  = size == max_masked_size ? ~std::uint64_t{0} : (std::uint64_t{1} << size) - 1;
+    std::size_t pos       = 0;
+    std::size_t candidate = 0;
+    while (pos < size) {
+        if (stop.stop_requested()) {
+            return false;
         }
-        if (expirations.contains(symb)) {
-            const auto& it = expirations.find(symb);
-            if (it->second != test_expiration) {
-                return false;
-            }
-        } else {
-            expirations.insert({symb, test_expiration});
+
+        const auto& leg = program[pos % program.size()];
+
+        if (pos && !(pos % program.size()) && !candidate) {
+            const Date last_expiration  = states[pos].last_expiration;
+            states[pos]                 = LegsState();
+            states[pos].last_expiration = last_expiration;
         }
-        last_signs_amount = 0;
-    } else if (std::holds_alternative<int>(leg_expiration)) {
-        const auto& expiration_offset = std::get<int>(leg_expiration);
-        if (expiration_offset != 0 && expiration_offset == static_cast<int>(last_signs_amount)) {
-            if (test_expiration != last_expiration) {
-                return false;
+
+        std::uint64_t candidates = candidate < max_masked_size ? unused & legs_masks[pos % program.size()] &
+                                                                     (~std::uint64_t{0} << candidate)
+                                                               : 0;
+        if (candidates && sorted) {
+            candidates &= sorted->strikes(leg, states[pos]) & sorted->expirations(leg, states[pos]);
+        }
+
+        bool placed = false;
+        for (; candidates; candidates &= candidates - 1) {
+            const int next = std::countr_zero(candidates);
+            if constexpr (rule_stats_enabled) {
+                search_counters.placements++;
+            }
+            states[pos + 1] = states[pos];
+            if (acceptable_leg(leg, components[next], states[pos + 1])) {
+                unused &= ~(std::uint64_t{1} << next);
+                order[pos++] = next;
+                placed       = true;
+                break;
             }
-        } else if ((expiration_offset > 0 && test_expiration <= last_expiration) ||
-                   (expiration_offset < 0 && test_expiration >= last_expiration)) {
-            return false;
         }
-        last_signs_amount = expiration_offset;
-    } else if (std::holds_alternative<ExpirationOffset>(leg_expiration)) {
-        const auto& exp_off = std::get<ExpirationOffset>(leg_expiration);
-        if (!last_expiration.check_offset(exp_off, test_expiration)) {
+
+        if (placed) {
+            candidate = 0;
+            continue;
+        }
+        if (!pos) {
             return false;
         }
-        return true;
+
+        pos--;
+        unused |= std::uint64_t{1} << order[pos];
+        candidate = order[pos] + 1;
     }
-    last_expiration = test_expiration;
+
     return true;
 }
 
-bool MultipleCombination::acceptable_legs(const std::vector<Component>& components,
-                                          const std::vector<int>& order) const {
-    std::unordered_map<char, double> strikes;
-    double last_strike                   = 0;
-    std::size_t strike_last_signs_amount = 0;
-    std::unordered_map<char, Date> expirations;
-    Date last_expiration;
-    std::size_t expiration_last_signs_amount = 0;
+MultipleCombination::SortedComponents::SortedComponents(const std::vector<Component>& components)
+    : size(components.size())
+    , all(size == max_masked_size ? ~std::uint64_t{0} : (std::uint64_t{1} << size) - 1) {
+    std::array<std::uint8_t, max_masked_size> ranks;
+    const auto by_rank = std::span(ranks).first(size);
+    std::iota(by_rank.begin(), by_rank.end(), 0);
 
-    for (std::size_t curr_comp_ind = 0; curr_comp_ind < components.size(); curr_comp_ind++) {
-        const auto& leg            = legs[curr_comp_ind % legs.size()];
-        const auto& curr_component = components[order[curr_comp_ind]];
+    strikes_ordered = std::none_of(components.begin(), components.end(),
+                                   [](const Component& component) { return std::isnan(component.strike); });
+    if (strikes_ordered) {
+        std::sort(by_rank.begin(), by_rank.end(),
+                  [&components](int left, int right) { return components[left].strike < components[right].strike; });
+        strikes_from[size] = 0;
+        for (std::size_t rank = size; rank--;) {
+            strike_values[rank] = components[by_rank[rank]].strike;
+            strikes_from[rank]  = strikes_from[rank + 1] | std::uint64_t{1} << by_rank[rank];
+        }
+    }
 
-        if (!(curr_comp_ind % legs.size())) {
-            strikes.clear();
-            last_strike              = 0;
-            strike_last_signs_amount = 0;
+    std::sort(by_rank.begin(), by_rank.end(), [&components](int left, int right) {
+        return components[left].expiration < components[right].expiration;
+    });
+    expirations_from[size] = 0;
+    for (std::size_t rank = size; rank--;) {
+        expiration_values[rank] = components[by_rank[rank]].expiration.days_since_epoch();
+        expirations_from[rank]  = expirations_from[rank + 1] | std::uint64_t{1} << by_rank[rank];
+    }
+}
+
+std::uint64_t MultipleCombination::SortedComponents::strikes(const CompiledLeg& leg, const LegsState& state) const {
+    if (!strikes_ordered) {
+        return all;
+    }
+    const auto values = std::span(strike_values).first(size);
+    switch (leg.strike_check) {
+    case ValueCheck::bind:
+        return state.bound_strikes >> leg.strike_arg & 1
+                   ? value_range(values, strikes_from, state.strikes[leg.strike_arg], 0, all)
+                   : all;
+    case ValueCheck::offset:
+        if (!leg.strike_arg) {
+            return all;
+        }
+        return value_range(values, strikes_from, state.last_strike,
+                           leg.strike_arg == state.strike_last_signs_amount ? 0 : leg.strike_arg, all);
+    default:
+        return all;
+    }
+}
 
-            expirations.clear();
-            expiration_last_signs_amount = 0;
+std::uint64_t MultipleCombination::SortedComponents::expirations(const CompiledLeg& leg,
+                                                                 const LegsState& state) const {
+    const auto values = std::span(expiration_values).first(size);
+    switch (leg.expiration_check) {
+    case ValueCheck::bind:
+        return state.bound_expirations >> leg.expiration_arg & 1
+                   ? value_range(values, expirations_from,
+                                 state.expirations[leg.expiration_arg].days_since_epoch(), 0, all)
+                   : all;
+    case ValueCheck::offset:
+        if (!leg.expiration_arg) {
+            return all;
         }
+        return value_range(values, expirations_from, state.last_expiration.days_since_epoch(),
+                           leg.expiration_arg == state.expiration_last_signs_amount ? 0 : leg.expiration_arg, all);
+    default:
+        return all;
+    }
+}
+
+bool MultipleCombination::acceptable_type(const std::vector<Component>& components) const {
+    if (components.empty() || components.size() % program.size()) {
+        return false;
+    }
 
-        if (leg.type != curr_component.type) {
+    for (const auto& it : components) {
+        if (!(types_mask & (1u << type_index(it.type)))) {
             return false;
         }
+    }
 
-        if ((std::holds_alternative<double>(leg.ratio) && std::get<double>(leg.ratio) != curr_component.ratio) ||
-            (std::holds_alternative<char>(leg.ratio) &&
-             std::get<char>(leg.ratio) != ((curr_component.ratio > 0) ? '+' : '-'))) {
+    return true;
+}
+
+bool MultipleCombination::check_strike(const CompiledLeg& leg, LegsState& state, double test_strike) const {
+    switch (leg.strike_check) {
+    case ValueCheck::bind: {
+        const std::uint32_t bit = 1u << leg.strike_arg;
+        if (state.bound_strikes & bit) {
+            if (state.strikes[leg.strike_arg] != test_strike) {
+                return false;
+            }
+        } else {
+            state.strikes[leg.strike_arg] = test_strike;
+            state.bound_strikes |= bit;
+        }
+        state.strike_last_signs_amount = 0;
+        break;
+    }
+    case ValueCheck::offset:
+        if (leg.strike_arg != 0 && leg.strike_arg == state.strike_last_signs_amount) {
+            if (test_strike != state.last_strike) {
+                return false;
+            }
+        } else if ((leg.strike_arg > 0 && test_strike <= state.last_strike) ||
+                   (leg.strike_arg < 0 && test_strike >= state.last_strike)) {
             return false;
         }
+        state.strike_last_signs_amount = leg.strike_arg;
+        break;
+    case ValueCheck::none:
+        [[fallthrough]];
+    case ValueCheck::period:
+        [[fallthrough]];
+    default:
+        state.strike_last_signs_amount = 0;
+        break;
+    }
+    state.last_strike = test_strike;
+    return true;
+}
+
+bool MultipleCombination::check_expiration(const CompiledLeg& leg, LegsState& state,
+                                           const Date& test_expiration) const {
+    switch (leg.expiration_check) {
+    case ValueCheck::bind: {
+        const std::uint32_t bit = 1u << leg.expiration_arg;
+        if (state.bound_expirations & bit) {
+            if (state.expirations[leg.expiration_arg] != test_expiration) {
+                return false;
+            }
+        } else {
+            state.expirations[leg.expiration_arg] = test_expiration;
+            state.bound_expirations |= bit;
+        }
+        state.expiration_last_signs_amount = 0;
+        break;
+    }
+    case ValueCheck::offset:
+        if (leg.expiration_arg != 0 && leg.expiration_arg == state.expiration_last_signs_amount) {
+            if (test_expiration != state.last_expiration) {
+                return false;
+            }
+        } else if ((leg.expiration_arg > 0 && test_expiration <= state.last_expiration) ||
+                   (leg.expiration_arg < 0 && test_expiration >= state.last_expiration)) {
+            return false;
+        }
+        state.expiration_last_signs_amount = leg.expiration_arg;
+        break;
+    case ValueCheck::period:
+        return state.last_expiration.check_offset(leg.expiration_period, test_expiration);
+    case ValueCheck::none:
+        [[fallthrough]];
+    default:
+        state.expiration_last_signs_amount = 0;
+        break;
+    }
+    state.last_expiration = test_expiration;
+    return true;
+}
 
-        if (!check_strike(leg.strike, strikes, last_strike, strike_last_signs_amount, curr_component.strike)) {
+bool MultipleCombination::feasible(const std::vector<Component>& components, LegsMasks& legs_masks) const {
+    const std::size_t size = components.size();
+    for (std::size_t leg = 0; leg < program.size(); leg++) {
+        for (std::size_t i = 0; i < size; i++) {
+            legs_masks[leg] |= static_cast<std::uint64_t>(accepts_ratio(program[leg], components[i])) << i;
+        }
+        if (!legs_masks[leg]) {
             return false;
         }
+    }
+
+    // Slot pos takes the leg pos % program.size().
+    LegsMasks slots;
+    for (std::size_t pos = 0; pos < size; pos++) {
+        slots[pos] = legs_masks[pos % program.size()];
+    }
+    return perfect_matching(std::span(slots).first(size));
+}
+
+bool MultipleCombination::accepts_ratio(const CompiledLeg& leg, const Component& component) {
+    if (leg.type != component.type) {
+        return false;
+    }
+
+    switch (leg.ratio_check) {
+    case RatioCheck::exact:
+        return leg.ratio == component.ratio;
+    case RatioCheck::positive:
+        return component.ratio > 0;
+    case RatioCheck::negative:
+        return !(component.ratio > 0);
+    }
+    return false;
+}
+
+bool MultipleCombination::overlap(const CompiledLeg& left, const CompiledLeg& right) {
+    if (left.type != right.type) {
+        return false;
+    }
+    if (left.ratio_check == RatioCheck::exact && right.ratio_check == RatioCheck::exact) {
+        return left.ratio == right.ratio;
+    }
+    if (left.ratio_check == RatioCheck::exact || right.ratio_check == RatioCheck::exact) {
+        const CompiledLeg& exact = left.ratio_check == RatioCheck::exact ? left : right;
+        const CompiledLeg& sign  = left.ratio_check == RatioCheck::exact ? right : left;
+        return (exact.ratio > 0) == (sign.ratio_check == RatioCheck::positive);
+    }
+    return left.ratio_check == right.ratio_check;
+}
+
+bool MultipleCombination::acceptable_leg(const CompiledLeg& leg, const Component& component, LegsState& state) const {
+    return accepts_ratio(leg, component) && check_strike(leg, state, component.strike) &&
+           check_expiration(leg, state, component.expiration);
+}
+
+bool MultipleCombination::acceptable_legs(const std::vector<Component>& components,
+                                          const std::vector<int>& order) const {
+    LegsState state;
+
+    for (std::size_t curr_comp_ind = 0; curr_comp_ind < components.size(); curr_comp_ind++) {
+        if (!(curr_comp_ind % program.size())) {
+            Date last_expiration  = state.last_expiration;
+            state                 = LegsState();
+            state.last_expiration = last_expiration;
+        }
 
-        if (!check_expiration(leg.expiration, expirations, last_expiration, expiration_last_signs_amount,
-                              curr_component.expiration)) {
+        if (!acceptable_leg(program[curr_comp_ind % program.size()], components[order[curr_comp_ind]], state)) {
             return false;
         }
     }
@@ -287,6 +1201,9 @@ bool MoreCombination::acceptable_type(const std::vector<Component>& components)
 }
 
 bool MoreCombination::acceptable_legs(const std::vector<Component>& components, const std::vector<int>& order) const {
+    if (legs.empty()) {
+        return order.empty();
+    }
     const auto& leg = legs[0];
 
     for (const auto& it : order) {
@@ -308,23 +1225,243 @@ bool MoreCombination::acceptable_legs(const std::vector<Component>& components,
     return true;
 }
 
-bool MoreCombination::acceptable_combination(const std::vector<Component>& components, std::vector<int>& order) const {
+bool MoreCombination::acceptable_combination(const std::vector<Component>& components, std::vector<int>& order,
+                                             std::stop_token) const {
     std::iota(order.begin(), order.end(), 0);
-    return acceptable_type(components) && acceptable_legs(components, order);
+    if (!acceptable_type(components)) {
+        if constexpr (rule_stats_enabled) {
+            search_counters.type_rejected = true;
+        }
+        return false;
+    }
+    return acceptable_legs(components, order);
 }
 
-std::string Combinations::classify(const std::vector<Component>& components, std::vector<int>& order) const {
-    std::vector<int> tmp_order(components.size());
+std::size_t Combinations::find_rule(const std::vector<Component>& components, std::vector<int>& tmp_order) const {
+    return find_rule(components, LegsSignature::of(components), RatioHistogram::of(components), tmp_order);
+}
 
-    for (const auto& comb : combinations) {
-        if (comb->acceptable_combination(components, tmp_order)) {
-            order.resize(tmp_order.size());
-            for (std::size_t i = 0; i < tmp_order.size(); i++) {
-                order[tmp_order[i]] = static_cast<int>(i + 1);
+std::size_t Combinations::find_rule(const std::vector<Component>& components, const LegsSignature& signature,
+                                    const RatioHistogram& ratios, std::vector<int>& tmp_order) const {
+    const std::array<const std::vector<std::size_t>*, 3> lists{
+        &find_rules(fixed_index, signature), &find_rules(multiple_index, signature.reduced()), &more_index};
+    std::array<std::size_t, 3> cursors{};
+
+    // The candidate lists are sorted, so merging them keeps the priority order of the resource.
+    while (true) {
+        std::size_t next = combinations.size();
+        std::size_t list = 0;
+        for (std::size_t i = 0; i < lists.size(); i++) {
+            if (cursors[i] < lists[i]->size() && (*lists[i])[cursors[i]] < next) {
+                next = (*lists[i])[cursors[i]];
+                list = i;
             }
-            return comb->get_name();
         }
+        if (next == combinations.size()) {
+            return unclassified;
+        }
+        cursors[list]++;
+
+        if (ratios.covers(ratio_histograms[next]) && try_rule(next, components, tmp_order)) {
+            return next;
+        }
+    }
+}
+
+bool Combinations::has_candidate(const LegsSignature& signature, const RatioHistogram& ratios) const {
+    const auto covered = [this, &ratios](std::size_t rule) { return ratios.covers(ratio_histograms[rule]); };
+    const std::vector<std::size_t>& fixed = find_rules(fixed_index, signature);
+    if (std::any_of(fixed.begin(), fixed.end(), covered)) {
+        return true;
+    }
+    const std::vector<std::size_t>& multiple = find_rules(multiple_index, signature.reduced());
+    if (std::any_of(multiple.begin(), multiple.end(), covered)) {
+        return true;
+    }
+    return std::any_of(more_index.begin(), more_index.end(), [this, &signature, &ratios](std::size_t rule) {
+        return static_cast<const MoreCombination&>(*combinations[rule]).may_accept(signature, ratios);
+    });
+}
+
+bool Combinations::try_rule(std::size_t rule, const std::vector<Component>& components, std::vector<int>& tmp_order,
+                            std::stop_token stop) const {
+    if constexpr (!rule_stats_enabled) {
+        return combinations[rule]->acceptable_combination(components, tmp_order, stop);
     }
 
-    return "Unclassified";
+    search_counters   = SearchCounters();
+    const auto start  = std::chrono::steady_clock::now();
+    const bool result = combinations[rule]->acceptable_combination(components, tmp_order, stop);
+    const auto time   = std::chrono::steady_clock::now() - start;
+
+    rule_stats->add(rule, RuleStats::attempts, 1);
+    rule_stats->add(rule, RuleStats::type_rejects, search_counters.type_rejected);
+    rule_stats->add(rule, RuleStats::placements, search_counters.placements);
+    rule_stats->add(rule, RuleStats::matches, result);
+    rule_stats->add(rule, RuleStats::nanoseconds, std::chrono::duration_cast<std::chrono::nanoseconds>(time).count());
+    return result;
+}
+
+std::string Combinations::classify(const std::vector<Component>& components, std::vector<int>& order) const {
+    std::vector<int>& tmp_order = scratch.order;
+    tmp_order.resize(components.size());
+
+    const std::size_t rule = find_rule(components, tmp_order);
+    if (rule == unclassified) {
+        return unclassified_name;
+    }
+
+    order.resize(tmp_order.size());
+    for (std::size_t i = 0; i < tmp_order.size(); i++) {
+        order[tmp_order[i]] = static_cast<int>(i + 1);
+    }
+    return combinations[rule]->get_name();
+}
+
+const Combination* Combinations::match(const std::vector<Component>& components, std::vector<int>& order) const {
+    order.resize(components.size());
+
+    const std::size_t rule = find_rule(components, order);
+    if (rule == unclassified) {
+        order.clear();
+        return nullptr;
+    }
+
+    // Invert the permutation cycle by cycle, marking the already inverted positions with negative values.
+    for (std::size_t i = 0; i < order.size(); i++) {
+        if (order[i] < 0) {
+            continue;
+        }
+        int prev = static_cast<int>(i);
+        int curr = order[i];
+        while (curr != static_cast<int>(i)) {
+            const int next = order[curr];
+            order[curr]    = -(prev + 1);
+            prev           = curr;
+            curr           = next;
+        }
+        order[i] = -(prev + 1);
+    }
+    for (auto& it : order) {
+        it = -it;
+    }
+
+    return combinations[rule].get();
+}
+
+void Combinations::prepare_batch(std::span<const std::vector<Component>> batch, ClassifiedBatch& result) {
+    result.rules.assign(batch.size(), unclassified);
+    result.offsets.resize(batch.size() + 1);
+    result.offsets[0] = 0;
+    for (std::size_t i = 0; i < batch.size(); i++) {
+        result.offsets[i + 1] = result.offsets[i] + batch[i].size();
+    }
+    result.orders.assign(result.offsets.back(), 0);
+}
+
+void Combinations::classify_range(std::span<const std::vector<Component>> batch, ClassifiedBatch& result,
+                                  std::size_t begin, std::size_t end) const {
+    std::vector<int>& tmp_order = scratch.order;
+    for (std::size_t i = begin; i < end; i++) {
+        tmp_order.resize(batch[i].size());
+        result.rules[i] = find_rule(batch[i], tmp_order);
+        if (result.rules[i] != unclassified) {
+            write_order(tmp_order, result.orders.data() + result.offsets[i]);
+        }
+    }
+}
+
+void Combinations::classify_batch(std::span<const std::vector<Component>> batch, ClassifiedBatch& result,
+                                  std::size_t threads) const {
+    prepare_batch(batch, result);
+    split_between_threads(batch.size(), threads, [this, batch, &result](std::size_t begin, std::size_t end) {
+        classify_range(batch, result, begin, end);
+    });
+}
+
+void Combinations::prepare_batch(const ComponentBatch& batch, ClassifiedBatch& result) {
+    result.rules.assign(batch.size(), unclassified);
+    result.offsets = batch.offsets;
+    result.orders.assign(result.offsets.back(), 0);
+}
+
+void Combinations::classify_range(const ComponentBatch& batch, ClassifiedBatch& result, std::size_t begin,
+                                  std::size_t end) const {
+    std::vector<Component>& components = scratch.components;
+    std::vector<int>& tmp_order        = scratch.order;
+    for (std::size_t i = begin; i < end; i++) {
+        // Most sets of a stream match no rule, those are rejected from the columns without being copied.
+        const LegsSignature signature = LegsSignature::of(batch, i);
+        const RatioHistogram ratios   = RatioHistogram::of(batch, i);
+        if (!has_candidate(signature, ratios)) {
+            result.rules[i] = unclassified;
+            continue;
+        }
+
+        batch.get(i, components);
+        tmp_order.resize(components.size());
+        result.rules[i] = find_rule(components, signature, ratios, tmp_order);
+        if (result.rules[i] != unclassified) {
+            write_order(tmp_order, result.orders.data() + result.offsets[i]);
+        }
+    }
+}
+
+void Combinations::classify_batch(const ComponentBatch& batch, ClassifiedBatch& result, std::size_t threads) const {
+    prepare_batch(batch, result);
+    split_between_threads(batch.size(), threads, [this, &batch, &result](std::size_t begin, std::size_t end) {
+        classify_range(batch, result, begin, end);
+    });
+}
+
+void Combinations::candidates(const std::vector<Component>& components, std::vector<std::size_t>& rules) const {
+    const LegsSignature signature = LegsSignature::of(components);
+    const std::array<const std::vector<std::size_t>*, 3> lists{
+        &find_rules(fixed_index, signature), &find_rules(multiple_index, signature.reduced()), &more_index};
+
+    const RatioHistogram ratios = RatioHistogram::of(components);
+
+    rules.clear();
+    for (const auto& list : lists) {
+        std::copy_if(list->begin(), list->end(), std::back_inserter(rules),
+                     [this, &ratios](std::size_t rule) { return ratios.covers(ratio_histograms[rule]); });
+    }
+    std::sort(rules.begin(), rules.end());
+}
+
+std::vector<RuleCounters> Combinations::stats() const {
+    return rule_stats ? rule_stats->total() : std::vector<RuleCounters>();
+}
+
+void Combinations::dump_stats(std::ostream& out) const {
+    const std::vector<RuleCounters> counters = stats();
+
+    std::vector<std::size_t> rules;
+    for (std::size_t rule = 0; rule < counters.size(); rule++) {
+        if (counters[rule].attempts) {
+            rules.push_back(rule);
+        }
+    }
+    std::stable_sort(rules.begin(), rules.end(), [&counters](std::size_t a, std::size_t b) {
+        return counters[a].nanoseconds > counters[b].nanoseconds;
+    });
+
+    out << "rule\tattempts\ttype rejects\tplacements\tmatches\tns\n";
+    for (const std::size_t rule : rules) {
+        const RuleCounters& counter = counters[rule];
+        out << rule_name(rule) << '\t' << counter.attempts << '\t' << counter.type_rejects << '\t'
+            << counter.placements << '\t' << counter.matches << '\t' << counter.nanoseconds << '\n';
+    }
+}
+
+std::size_t Combinations::size() const {
+    return combinations.size();
+}
+
+const Combination* Combinations::rule(std::size_t rule) const {
+    return rule == unclassified ? nullptr : combinations[rule].get();
+}
+
+const std::string& Combinations::rule_name(std::size_t rule) const {
+    return rule == unclassified ? unclassified_name : combinations[rule]->get_name();
 }
@@ -0,0 +1,256 @@
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <fstream>
+
+#include "combinations/Combinations.hpp"
+
+// Compiled rules image: a fixed header followed by the rules, each written as its cardinality, minimum count, names
+// and legs. Numbers are stored in the native byte order, strings as their length and bytes, variants as the index of
+// the alternative and its value.
+
+namespace {
+
+constexpr std::array<char, 8> magic{'C', 'O', 'M', 'B', 'R', 'U', 'L', 'E'};
+constexpr std::uint32_t version = 1;
+
+struct Header {
+    std::array<char, 8> magic;
+    std::uint32_t version;
+    std::uint32_t rules;
+    std::uint64_t size;
+    std::uint64_t checksum;
+};
+
+// FNV-1a
+std::uint64_t checksum(std::string_view data) {
+    std::uint64_t hash = 14695981039346656037ull;
+    for (const char c : data) {
+        hash = (hash ^ static_cast<unsigned char>(c)) * 1099511628211ull;
+    }
+    return hash;
+}
+
+class Writer {
+public:
+    template <typename T>
+    void put(const T& value) {
+        data.append(reinterpret_cast<const char*>(&value), sizeof(value));
+    }
+
+    void put(const std::string& value) {
+        put(static_cast<std::uint32_t>(value.size()));
+        data.append(value);
+    }
+
+    void put(const ExpirationOffset& value) {
+        put(static_cast<std::uint64_t>(value.num()));
+        put(value.per());
+    }
+
+    template <typename... Ts>
+    void put(const std::variant<Ts...>& value) {
+        put(static_cast<std::uint8_t>(value.index()));
+        std::visit([this](const auto& alternative) { put(alternative); }, value);
+    }
+
+    std::string data;
+};
+
+// Reads values back from an image, every read fails once the image is over.
+class Reader {
+public:
+    explicit Reader(std::string_view data) : data(data) {}
+
+    template <typename T>
+    bool get(T& value) {
+        if (data.size() < sizeof(value)) {
+            return false;
+        }
+        std::memcpy(&value, data.data(), sizeof(value));
+        data.remove_prefix(sizeof(value));
+        return true;
+    }
+
+    bool get(std::string& value) {
+        std::uint32_t size = 0;
+        if (!get(size) || data.size() < size) {
+            return false;
+        }
+        value.assign(data.data(), size);
+        data.remove_prefix(size);
+        return true;
+    }
+
+    bool get(ExpirationOffset& value) {
+        std::uint64_t num = 0;
+        TimePeriods period{};
+        if (!get(num) || !get(period)) {
+            return false;
+        }
+        value = ExpirationOffset(num, period);
+        return true;
+    }
+
+    template <typename... Ts>
+    bool get(std::variant<Ts...>& value) {
+        std::uint8_t index = 0;
+        return get(index) && get_alternative<0, Ts...>(index, value);
+    }
+
+    bool empty() const {
+        return data.empty();
+    }
+
+private:
+    template <std::size_t I, typename T, typename... Ts, typename Variant>
+    bool get_alternative(std::uint8_t index, Variant& value) {
+        if (index == I) {
+            return get(value.template emplace<I>());
+        }
+        if constexpr (sizeof...(Ts) > 0) {
+            return get_alternative<I + 1, Ts...>(index, value);
+        } else {
+            return false;
+        }
+    }
+
+    std::string_view data;
+};
+
+// Read-only mapping of a whole file.
+class Mapping {
+public:
+    explicit Mapping(const std::filesystem::path& path) {
+        const int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0) {
+            return;
+        }
+        struct stat info {};
+        if (::fstat(fd, &info) == 0 && info.st_size > 0) {
+            void* address = ::mmap(nullptr, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (address != MAP_FAILED) {
+                data = std::string_view(static_cast<const char*>(address), info.st_size);
+            }
+        }
+        ::close(fd);
+    }
+
+    Mapping(const Mapping&)            = delete;
+    Mapping& operator=(const Mapping&) = delete;
+
+    ~Mapping() {
+        if (!data.empty()) {
+            ::munmap(const_cast<char*>(data.data()), data.size());
+        }
+    }
+
+    std::string_view data;
+};
+
+struct Rule {
+    Cardinality cardinality;
+    std::uint32_t min_count;
+    CombinationNames names;
+    std::vector<Leg> legs;
+};
+
+bool read_rule(Reader& reader, Rule& rule) {
+    std::uint32_t legs = 0;
+    if (!reader.get(rule.cardinality) || !reader.get(rule.min_count) || !reader.get(rule.names.name) ||
+        !reader.get(rule.names.shortname) || !reader.get(rule.names.identifier) || !reader.get(legs)) {
+        return false;
+    }
+    if (rule.cardinality != Cardinality::fixed && rule.cardinality != Cardinality::multiple &&
+        rule.cardinality != Cardinality::more) {
+        return false;
+    }
+
+    for (; legs; legs--) {
+        Leg& leg = rule.legs.emplace_back();
+        if (!reader.get(leg.type) || !reader.get(leg.ratio) || !reader.get(leg.strike) || !reader.get(leg.expiration)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+}  // anonymous namespace
+
+std::string Combinations::compiled_image() const {
+    Writer writer;
+    for (const auto& rule : combinations) {
+        const Cardinality cardinality = rule->get_cardinality();
+        const std::size_t min_count =
+            cardinality == Cardinality::more ? static_cast<const MoreCombination&>(*rule).get_min_count() : 0;
+
+        writer.put(cardinality);
+        writer.put(static_cast<std::uint32_t>(min_count));
+        writer.put(rule->get_name());
+        writer.put(rule->get_shortname());
+        writer.put(rule->get_identifier());
+        writer.put(static_cast<std::uint32_t>(rule->get_legs().size()));
+        for (const Leg& leg : rule->get_legs()) {
+            writer.put(leg.type);
+            writer.put(leg.ratio);
+            writer.put(leg.strike);
+            writer.put(leg.expiration);
+        }
+    }
+
+    const Header header{magic, version, static_cast<std::uint32_t>(combinations.size()), writer.data.size(),
+                        checksum(writer.data)};
+    return std::string(reinterpret_cast<const char*>(&header), sizeof(header)) + writer.data;
+}
+
+bool Combinations::load_image(std::string_view image) {
+    Header header{};
+    Reader reader(image);
+    if (!reader.get(header) || header.magic != magic || header.version != version ||
+        header.size != image.size() - sizeof(header)) {
+        return false;
+    }
+    const std::string_view payload = image.substr(sizeof(header));
+    if (checksum(payload) != header.checksum) {
+        return false;
+    }
+
+    // Every rule takes more than a byte, which bounds the count before anything is allocated for it
+    if (header.rules > payload.size()) {
+        return false;
+    }
+
+    // Rules are added only once the whole image is read and every rule is known to be accepted by add_rule, so that a
+    // broken one leaves the loaded rules untouched
+    std::vector<Rule> rules(header.rules);
+    for (Rule& rule : rules) {
+        if (!read_rule(reader, rule) ||
+            (rule.cardinality != Cardinality::more && !MultipleCombination::supports(rule.legs))) {
+            return false;
+        }
+    }
+    if (!reader.empty()) {
+        return false;
+    }
+
+    for (Rule& rule : rules) {
+        add_rule(rule.cardinality, std::move(rule.names), rule.min_count, std::move(rule.legs));
+    }
+    size_stats();
+    return true;
+}
+
+bool Combinations::save_compiled(const std::filesystem::path& snapshot) const {
+    const std::string image = compiled_image();
+
+    std::ofstream out(snapshot, std::ios::binary | std::ios::trunc);
+    out.write(image.data(), image.size());
+    return static_cast<bool>(out.flush());
+}
+
+bool Combinations::load_compiled(const std::filesystem::path& snapshot) {
+    const Mapping mapping(snapshot);
+    return load_image(mapping.data);
+}
@@ -1,8 +1,72 @@
 #include "combinations/Component.hpp"
 
+#include <cctype>
+#include <charconv>
+#include <cmath>
 #include <iomanip>
 #include <sstream>
 
+namespace {
+
+void skip_spaces(std::string_view& str) {
+    while (!str.empty() && std::isspace(static_cast<unsigned char>(str.front()))) {
+        str.remove_prefix(1);
+    }
+}
+
+bool read_double(std::string_view& str, double& value) {
+    skip_spaces(str);
+    if (str.size() > 1 && str.front() == '+' && str[1] != '-') {
+        str.remove_prefix(1);
+    }
+
+    // from_chars also takes nan and inf, which the stream extraction of from_stream does not
+    const auto [ptr, ec] = std::from_chars(str.data(), str.data() + str.size(), value);
+    if (ec != std::errc() || !std::isfinite(value)) {
+        return false;
+    }
+    str.remove_prefix(ptr - str.data());
+    return true;
+}
+
+bool read_digits(std::string_view& str, int& value, std::size_t max_digits) {
+    std::size_t digits = 0;
+    value              = 0;
+    while (digits < max_digits && digits < str.size() && std::isdigit(static_cast<unsigned char>(str[digits]))) {
+        value = value * 10 + (str[digits++] - '0');
+    }
+    str.remove_prefix(digits);
+    return digits > 0;
+}
+
+bool read_separator(std::string_view& str) {
+    if (str.empty() || str.front() != '-') {
+        return false;
+    }
+    str.remove_prefix(1);
+    return true;
+}
+
+bool read_date(std::string_view& str, Date& date) {
+    skip_spaces(str);
+
+    int year  = 0;
+    int month = 0;
+    int day   = 0;
+    if (!read_digits(str, year, 4) || !read_separator(str) || !read_digits(str, month, 2) || !read_separator(str) ||
+        !read_digits(str, day, 2)) {
+        return false;
+    }
+    if (month < 1 || month > 12 || day < 1 || day > Date::days_in_month(year, month)) {
+        return false;
+    }
+
+    date = Date(year, month, day);
+    return true;
+}
+
+}  // anonymous namespace
+
 Component Component::from_stream(std::istream& strm) {
     Component component;
 
@@ -45,7 +109,7 @@ Component Component::from_stream(std::istream& strm) {
 
     std::tm tmp;
     strm >> std::get_time(&tmp, "%Y-%m-%d");
-    if (strm.fail()) {
+    if (strm.fail() || tmp.tm_mday > Date::days_in_month(tmp.tm_year + 1900, tmp.tm_mon + 1)) {
         return {};
     }
 
@@ -54,6 +118,47 @@ Component Component::from_stream(std::istream& strm) {
 }
 
 Component Component::from_string(const std::string& str) {
-    std::istringstream strm{str};
-    return from_stream(strm);
+    Component component;
+    parse(str, component);
+    return component;
+}
+
+bool Component::parse(std::string_view str, Component& component) {
+    component = {};
+
+    skip_spaces(str);
+    if (str.empty()) {
+        return false;
+    }
+
+    bool read_strike = false;
+    const auto type  = static_cast<InstrumentType>(str.front());
+    str.remove_prefix(1);
+    switch (type) {
+    case InstrumentType::C:
+        [[fallthrough]];
+    case InstrumentType::O:
+        [[fallthrough]];
+    case InstrumentType::P:
+        read_strike = true;
+        break;
+    case InstrumentType::F:
+        [[fallthrough]];
+    case InstrumentType::U:
+        break;
+    case InstrumentType::Unknown:
+        [[fallthrough]];
+    default:
+        return false;
+    }
+
+    Component tmp;
+    tmp.type = type;
+    if (!read_double(str, tmp.ratio) || (read_strike && !read_double(str, tmp.strike)) ||
+        !read_date(str, tmp.expiration)) {
+        return false;
+    }
+
+    component = tmp;
+    return true;
 }
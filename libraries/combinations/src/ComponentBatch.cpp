@@ -0,0 +1,50 @@
+#include "combinations/ComponentBatch.hpp"
+
+ComponentBatch::ComponentBatch(std::span<const std::vector<Component>> batch) {
+    std::size_t legs = 0;
+    for (const auto& components : batch) {
+        legs += components.size();
+    }
+    types.reserve(legs);
+    ratios.reserve(legs);
+    strikes.reserve(legs);
+    expirations.reserve(legs);
+    offsets.reserve(batch.size() + 1);
+
+    for (const auto& components : batch) {
+        push_back(components);
+    }
+}
+
+void ComponentBatch::push_back(const std::vector<Component>& components) {
+    for (const auto& component : components) {
+        types.push_back(component.type);
+        ratios.push_back(component.ratio);
+        strikes.push_back(component.strike);
+        expirations.push_back(component.expiration.days_since_epoch());
+    }
+    offsets.push_back(types.size());
+}
+
+void ComponentBatch::clear() {
+    types.clear();
+    ratios.clear();
+    strikes.clear();
+    expirations.clear();
+    offsets.assign(1, 0);
+}
+
+std::size_t ComponentBatch::size() const {
+    return offsets.size() - 1;
+}
+
+void ComponentBatch::get(std::size_t set, std::vector<Component>& components) const {
+    const std::size_t begin = offsets[set];
+    components.resize(offsets[set + 1] - begin);
+    for (std::size_t i = 0; i < components.size(); i++) {
+        components[i].type       = types[begin + i];
+        components[i].ratio      = ratios[begin + i];
+        components[i].strike     = strikes[begin + i];
+        components[i].expiration = Date::from_days_since_epoch(expirations[begin + i]);
+    }
+}
@@ -13,93 +13,103 @@ TimePeriods ExpirationOffset::per() const {
     return period;
 }
 
-Date::Date(std::tm& date) : date(date) {}
+Date::Date(std::tm& date) : Date(date.tm_year + 1900, date.tm_mon + 1, date.tm_mday) {}
+
+Date::Date(int year, int month, int day) : days(days_from_civil(year, month, day)) {}
+
+// Day number of a civil date, see http://howardhinnant.github.io/date_algorithms.html#days_from_civil. The day is
+// allowed to exceed the length of the month and then overflows into the following ones.
+std::int32_t Date::days_from_civil(int year, int month, int day) {
+    year -= month <= 2;
+    const int era                   = (year >= 0 ? year : year - 399) / 400;
+    const unsigned year_of_era      = static_cast<unsigned>(year - era * 400);
+    const unsigned month_from_march = static_cast<unsigned>(month > 2 ? month - 3 : month + 9);
+    const unsigned day_of_year      = (153 * month_from_march + 2) / 5 + static_cast<unsigned>(day) - 1;
+    const unsigned day_of_era       = year_of_era * 365 + year_of_era / 4 - year_of_era / 100 + day_of_year;
+    return era * 146097 + static_cast<std::int32_t>(day_of_era) - 719468;
+}
 
-bool Date::is_leap(std::size_t year) {
-    return ((year % 4 && !(year % 100)) || year % 400);
+int Date::days_in_month(int year, int month) {
+    static constexpr int days[] = {31, 28, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31};
+    const bool leap = year % 4 == 0 && (year % 100 != 0 || year % 400 == 0);
+    return month == 2 && leap ? 29 : days[month - 1];
 }
 
-std::size_t Date::days_in_month(std::size_t month, std::size_t year) {
-    std::array<std::size_t, 12> days_in_month{31, 28, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31};
-    if (is_leap(year) && month == 1) {
-        return 29;
-    }
-    return days_in_month[month];
+void Date::to_civil(int& year, int& month, int& day) const {
+    const std::int32_t shifted      = days + 719468;
+    const int era                   = (shifted >= 0 ? shifted : shifted - 146096) / 146097;
+    const unsigned day_of_era       = static_cast<unsigned>(shifted - era * 146097);
+    const unsigned year_of_era      = (day_of_era - day_of_era / 1460 + day_of_era / 36524 - day_of_era / 146096) / 365;
+    const unsigned day_of_year      = day_of_era - (365 * year_of_era + year_of_era / 4 - year_of_era / 100);
+    const unsigned month_from_march = (5 * day_of_year + 2) / 153;
+
+    day   = static_cast<int>(day_of_year - (153 * month_from_march + 2) / 5 + 1);
+    month = static_cast<int>(month_from_march < 10 ? month_from_march + 3 : month_from_march - 9);
+    year  = static_cast<int>(year_of_era) + era * 400 + (month <= 2);
 }
 
-Date Date::normalize_date(std::size_t day, std::size_t month, std::size_t year) {
-    year += month / 12;
-    month %= 12;
-    while (day > days_in_month(month, year)) {
-        day -= days_in_month(month++, year);
-        year += month / 12;
-        month %= 12;
-    }
+int Date::months() const {
+    int year  = 0;
+    int month = 0;
+    int day   = 0;
+    to_civil(year, month, day);
+    return year * 12 + month - 1;
+}
 
-    year += month / 12;
-    month %= 12;
+std::int32_t Date::days_since_epoch() const {
+    return days;
+}
 
-    std::tm tmp;
-    tmp.tm_year = static_cast<int>(year);
-    tmp.tm_mon  = static_cast<int>(month);
-    tmp.tm_mday = static_cast<int>(day);
-    return Date(tmp);
+Date Date::from_days_since_epoch(std::int32_t days) {
+    Date date;
+    date.days = days;
+    return date;
 }
 
-bool Date::check_offset(const ExpirationOffset& offset, const Date& test_date) {
-    std::size_t day   = date.tm_mday;
-    std::size_t month = date.tm_mon;
-    std::size_t year  = date.tm_year;
+bool Date::check_offset(const ExpirationOffset& offset, const Date& test_date) const {
+    const int num = static_cast<int>(offset.num());
 
     switch (offset.per()) {
-    case TimePeriods::y:
-        year += offset.num();
-        break;
+    case TimePeriods::d:
+        return test_date.days == days + num;
     case TimePeriods::q:
-        month += offset.num() * 3;
-        day = test_date.date.tm_mday;
-        break;
+        return test_date.months() == months() + num * 3;
     case TimePeriods::m:
-        month += offset.num();
-        break;
-    case TimePeriods::d:
-        day += offset.num();
-        break;
+        [[fallthrough]];
+    case TimePeriods::y: {
+        int year  = 0;
+        int month = 0;
+        int day   = 0;
+        to_civil(year, month, day);
+
+        const int shifted = year * 12 + month - 1 + (offset.per() == TimePeriods::y ? num * 12 : num);
+        return test_date.days == days_from_civil(shifted / 12, shifted % 12 + 1, day);
+    }
     default:
-        break;
+        return test_date == *this;
     }
-
-    Date new_date = normalize_date(day, month, year);
-    return test_date == new_date;
 }
 
 bool operator==(const Date& left, const Date& right) {
-    return left.date.tm_year == right.date.tm_year && left.date.tm_mon == right.date.tm_mon &&
-           left.date.tm_mday == right.date.tm_mday;
+    return left.days == right.days;
 }
 
 bool operator!=(const Date& left, const Date& right) {
-    return !(left == right);
+    return left.days != right.days;
 }
 
 bool operator<(const Date& left, const Date& right) {
-    if (left.date.tm_year == right.date.tm_year) {
-        if (left.date.tm_mon == right.date.tm_mon) {
-            return left.date.tm_mday < right.date.tm_mday;
-        }
-        return left.date.tm_mon < right.date.tm_mon;
-    }
-    return left.date.tm_year < right.date.tm_year;
+    return left.days < right.days;
 }
 
 bool operator>(const Date& left, const Date& right) {
-    return !(left < right) && (left != right);
+    return left.days > right.days;
 }
 
 bool operator>=(const Date& left, const Date& right) {
-    return !(left < right);
+    return left.days >= right.days;
 }
 
 bool operator<=(const Date& left, const Date& right) {
-    return !(left > right);
+    return left.days <= right.days;
 }
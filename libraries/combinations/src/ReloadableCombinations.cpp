@@ -0,0 +1,54 @@
+#include "combinations/ReloadableCombinations.hpp"
+
+ReloadableCombinations::ReloadableCombinations(std::filesystem::path resource, bool compiled)
+    : resource(std::move(resource))
+    , compiled(compiled)
+    , current(std::make_shared<const Combinations>())
+    , reloader([this](std::stop_token stop) { run(stop); }) {}
+
+bool ReloadableCombinations::reload() {
+    auto combinations = std::make_shared<Combinations>();
+
+    std::lock_guard lock(load_mutex);
+    if (compiled ? !combinations->load_compiled(resource) : !combinations->load(resource)) {
+        failed.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+    current.store(std::move(combinations), std::memory_order_release);
+    loads.fetch_add(1, std::memory_order_release);
+    return true;
+}
+
+void ReloadableCombinations::request_reload() {
+    {
+        std::lock_guard lock(request_mutex);
+        pending = true;
+    }
+    requested.notify_one();
+}
+
+ReloadableCombinations::Snapshot ReloadableCombinations::snapshot() const {
+    return current.load(std::memory_order_acquire);
+}
+
+std::string ReloadableCombinations::classify(const std::vector<Component>& components, std::vector<int>& order) const {
+    return snapshot()->classify(components, order);
+}
+
+std::size_t ReloadableCombinations::generation() const {
+    return loads.load(std::memory_order_acquire);
+}
+
+std::size_t ReloadableCombinations::failures() const {
+    return failed.load(std::memory_order_relaxed);
+}
+
+void ReloadableCombinations::run(std::stop_token stop) {
+    std::unique_lock lock(request_mutex);
+    while (requested.wait(lock, stop, [this] { return pending; })) {
+        pending = false;
+        lock.unlock();
+        reload();
+        lock.lock();
+    }
+}
@@ -0,0 +1,118 @@
+#include "combinations/RuleStats.hpp"
+
+#include <algorithm>
+
+namespace {
+
+std::atomic<std::uint64_t> next_id{1};
+
+// Block of the calling thread in the instance it counted for last.
+struct LocalBlock {
+    std::uint64_t id = 0;
+    void* block      = nullptr;
+};
+
+thread_local LocalBlock local_block;
+
+}  // anonymous namespace
+
+struct RuleStats::ThreadBlocks {
+    std::vector<std::weak_ptr<Shared>> instances;
+
+    ~ThreadBlocks() {
+        for (const auto& instance : instances) {
+            const std::shared_ptr<Shared> shared = instance.lock();
+            if (!shared) {
+                continue;
+            }
+            std::lock_guard lock(shared->mutex);
+            const auto it = shared->blocks.find(std::this_thread::get_id());
+            if (it == shared->blocks.end()) {
+                continue;
+            }
+            for (std::size_t rule = 0; rule < shared->exited.size(); rule++) {
+                shared->exited[rule] += load(*it->second, rule);
+            }
+            shared->blocks.erase(it);
+        }
+    }
+};
+
+RuleCounters& RuleCounters::operator+=(const RuleCounters& other) {
+    attempts += other.attempts;
+    type_rejects += other.type_rejects;
+    placements += other.placements;
+    matches += other.matches;
+    nanoseconds += other.nanoseconds;
+    return *this;
+}
+
+RuleStats::RuleStats(std::size_t rules)
+    : rules(rules), id(next_id.fetch_add(1, std::memory_order_relaxed)), shared(std::make_shared<Shared>()) {
+    shared->exited.resize(rules);
+}
+
+void RuleStats::add(std::size_t rule, Counter counter, std::uint64_t value) {
+    auto& count = local()[rule][counter];
+    count.store(count.load(std::memory_order_relaxed) + value, std::memory_order_relaxed);
+}
+
+RuleCounters RuleStats::load(const Block& block, std::size_t rule) {
+    const auto& counts = block[rule];
+    return RuleCounters{counts[attempts].load(std::memory_order_relaxed),
+                        counts[type_rejects].load(std::memory_order_relaxed),
+                        counts[placements].load(std::memory_order_relaxed),
+                        counts[matches].load(std::memory_order_relaxed),
+                        counts[nanoseconds].load(std::memory_order_relaxed)};
+}
+
+std::vector<RuleCounters> RuleStats::total() const {
+    std::lock_guard lock(shared->mutex);
+    std::vector<RuleCounters> result = shared->exited;
+    for (const auto& [thread, block] : shared->blocks) {
+        for (std::size_t rule = 0; rule < rules; rule++) {
+            result[rule] += load(*block, rule);
+        }
+    }
+    return result;
+}
+
+std::size_t RuleStats::threads() const {
+    std::lock_guard lock(shared->mutex);
+    return shared->blocks.size();
+}
+
+void RuleStats::resize(std::size_t rules) {
+    std::lock_guard lock(shared->mutex);
+    for (auto& [thread, block] : shared->blocks) {
+        auto resized = std::make_unique<Block>(rules);
+        for (std::size_t rule = 0; rule < std::min(rules, this->rules); rule++) {
+            for (std::size_t counter = 0; counter < counters; counter++) {
+                (*resized)[rule][counter].store((*block)[rule][counter].load(std::memory_order_relaxed),
+                                                std::memory_order_relaxed);
+            }
+        }
+        block = std::move(resized);
+    }
+    shared->exited.resize(rules);
+    this->rules = rules;
+    id          = next_id.fetch_add(1, std::memory_order_relaxed);
+}
+
+RuleStats::Block& RuleStats::local() {
+    if (local_block.id != id) {
+        thread_local ThreadBlocks thread_blocks;
+
+        std::lock_guard lock(shared->mutex);
+        auto& block = shared->blocks[std::this_thread::get_id()];
+        if (!block) {
+            block = std::make_unique<Block>(rules);
+            // Instances destroyed since are dropped, so that a long lived thread does not collect them.
+            std::erase_if(thread_blocks.instances, [](const auto& instance) { return instance.expired(); });
+            thread_blocks.instances.push_back(shared);
+        }
+        local_block.block = block.get();
+        local_block.id    = id;
+    }
+    return *static_cast<Block*>(local_block.block);
+}
@@ -0,0 +1,117 @@
+#include <atomic>
+#include <cstdlib>
+#include <new>
+#include <vector>
+
+#include "combinations/ClassificationCache.hpp"
+#include "combinations/Combinations.hpp"
+#include "combinations/Component.hpp"
+#include "gtest/gtest.h"
+
+namespace {
+
+std::atomic<bool> counting{false};
+std::atomic<std::size_t> allocations{0};
+
+// Number of allocations made by the call.
+template <typename Call>
+std::size_t count_allocations(Call&& call) {
+    allocations = 0;
+    counting    = true;
+    call();
+    counting = false;
+    return allocations;
+}
+
+std::vector<Component> bundle(std::size_t years) {
+    std::vector<Component> components;
+    for (std::size_t i = 0; i < years; ++i) {
+        for (const char* date : {"2010-03-01", "2010-06-01", "2010-09-01", "2010-12-01"}) {
+            components.push_back(Component::from_string(std::string("F 1 ") + date));
+        }
+    }
+    return components;
+}
+
+struct AllocTest: ::testing::Test {
+    const std::vector<std::vector<Component>> requests = {
+        {
+            Component::from_string("F 1 2013-12-21"),
+            Component::from_string("F 1 2013-10-19"),
+            Component::from_string("F -2 2013-11-16"),
+        },
+        {
+            Component::from_string("U -10 2010-03-01"),
+            Component::from_string("C -1 2100 2010-03-02"),
+            Component::from_string("P 1 2000 2010-03-02"),
+            Component::from_string("C 1 2100 2010-03-01"),
+            Component::from_string("P -1 2000 2010-03-01"),
+        },
+        {
+            Component::from_string("C 1 100 2013-10-19"),
+            Component::from_string("C 1 100 2013-10-19"),
+        },
+        bundle(5),
+    };
+
+    Combinations combinations;
+
+    // Without rules every request would be rejected before anything is allocated, so the checks would pass vacuously.
+    void SetUp() override { ASSERT_TRUE(combinations.load("test/etc/combinations.xml")); }
+};
+
+}  // anonymous namespace
+
+void* operator new(std::size_t size) {
+    if (counting.load(std::memory_order_relaxed)) {
+        allocations.fetch_add(1, std::memory_order_relaxed);
+    }
+    if (void* ptr = std::malloc(size ? size : 1)) {
+        return ptr;
+    }
+    throw std::bad_alloc();
+}
+
+// Not inlined, so that the compiler does not take the free for a mismatch with the new at the call sites.
+[[gnu::noinline]] void operator delete(void* ptr) noexcept {
+    std::free(ptr);
+}
+
+[[gnu::noinline]] void operator delete(void* ptr, std::size_t) noexcept {
+    std::free(ptr);
+}
+
+TEST_F(AllocTest, match) {
+    std::vector<int> order;
+    for (const auto& components : requests) {
+        combinations.match(components, order);
+    }
+    ASSERT_EQ(0, count_allocations([&] {
+                  for (const auto& components : requests) {
+                      combinations.match(components, order);
+                  }
+              }));
+}
+
+TEST_F(AllocTest, classify_batch) {
+    ClassifiedBatch result;
+    combinations.classify_batch(requests, result);
+    ASSERT_EQ(0, count_allocations([&] { combinations.classify_batch(requests, result); }));
+
+    const ComponentBatch columns{requests};
+    combinations.classify_batch(columns, result);
+    ASSERT_EQ(0, count_allocations([&] { combinations.classify_batch(columns, result); }));
+}
+
+TEST_F(AllocTest, cache_hit) {
+    ClassificationCache cache{combinations, 64};
+    std::vector<int> order;
+    for (const auto& components : requests) {
+        cache.match(components, order);
+    }
+    ASSERT_EQ(0, count_allocations([&] {
+                  for (const auto& components : requests) {
+                      cache.match(components, order);
+                  }
+              }));
+}
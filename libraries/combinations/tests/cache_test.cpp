@@ -0,0 +1,129 @@
+#include <limits>
+#include <thread>
+#include <vector>
+
+#include "combinations/ClassificationCache.hpp"
+#include "combinations/Combinations.hpp"
+#include "combinations/Component.hpp"
+#include "gtest/gtest.h"
+
+namespace {
+
+struct CacheTest: ::testing::Test {
+    const std::filesystem::path path{"test/etc/combinations.xml"};
+    Combinations combinations;
+
+    CacheTest() { combinations.load(path); }
+};
+
+const std::vector<Component> calendar = {
+    Component::from_string("C 1 2000 2010-03-02"),
+    Component::from_string("C -1 2000 2010-03-01"),
+};
+
+const std::vector<Component> calendar_reversed = {
+    Component::from_string("C -1 2000 2010-03-01"),
+    Component::from_string("C 1 2000 2010-03-02"),
+};
+
+const std::vector<Component> unclassified = {
+    Component::from_string("P 1 100 2013-10-18"),
+    Component::from_string("C 1 100 2013-10-19"),
+};
+
+}  // anonymous namespace
+
+TEST_F(CacheTest, hit_remaps_order) {
+    ClassificationCache cache{combinations, 64};
+    std::vector<int> order;
+
+    const Combination* rule = cache.match(calendar, order);
+    ASSERT_NE(nullptr, rule);
+    ASSERT_EQ("Call calendar spread", rule->get_name());
+    ASSERT_EQ((std::vector<int>{2, 1}), order);
+    ASSERT_EQ(0, cache.hits());
+    ASSERT_EQ(1, cache.misses());
+
+    ASSERT_EQ(rule, cache.match(calendar_reversed, order));
+    ASSERT_EQ((std::vector<int>{1, 2}), order);
+    ASSERT_EQ(1, cache.hits());
+
+    ASSERT_EQ(nullptr, cache.match(unclassified, order));
+    ASSERT_EQ(nullptr, cache.match(unclassified, order));
+    ASSERT_TRUE(order.empty());
+    ASSERT_EQ(2, cache.hits());
+    ASSERT_EQ(2, cache.misses());
+}
+
+TEST_F(CacheTest, nan) {
+    // Components are built directly, as parsing rejects NaN.
+    std::vector<Component> components = calendar;
+    components[0].strike = std::numeric_limits<double>::quiet_NaN();
+    components.push_back(components[0]);
+    components.push_back(calendar[1]);
+
+    ClassificationCache cache{combinations, 64};
+    std::vector<int> expected;
+    std::vector<int> order;
+    const Combination* rule = combinations.match(components, expected);
+    ASSERT_EQ(rule, cache.match(components, order));
+    ASSERT_EQ(expected, order);
+    ASSERT_EQ(rule, cache.match(components, order));
+    ASSERT_EQ(expected, order);
+    ASSERT_EQ(1, cache.hits());
+    ASSERT_EQ(1, cache.misses());
+}
+
+TEST_F(CacheTest, capacity) {
+    ClassificationCache cache{combinations, 1, 1};
+    ASSERT_EQ(1, cache.capacity());
+
+    std::vector<int> order;
+    cache.match(calendar, order);
+    cache.match(unclassified, order);
+    cache.match(calendar_reversed, order);
+    ASSERT_EQ(0, cache.hits());
+    ASSERT_EQ(3, cache.misses());
+
+    ClassificationCache disabled{combinations, 0};
+    disabled.match(calendar, order);
+    disabled.match(calendar, order);
+    ASSERT_EQ(0, disabled.hits());
+    ASSERT_EQ(2, disabled.misses());
+    ASSERT_EQ(0, disabled.size());
+}
+
+TEST_F(CacheTest, capacity_split) {
+    for (const std::size_t capacity : {1, 3, 10, 16, 17, 40}) {
+        ClassificationCache cache{combinations, capacity};
+        ASSERT_EQ(capacity, cache.capacity());
+
+        std::vector<int> order;
+        std::vector<Component> components = calendar;
+        for (std::size_t i = 0; i < 100; ++i) {
+            components[0].strike = components[1].strike = 1000 + static_cast<double>(i);
+            cache.match(components, order);
+            ASSERT_LE(cache.size(), capacity);
+        }
+        ASSERT_LT(0, cache.size());
+    }
+}
+
+TEST_F(CacheTest, threads) {
+    ClassificationCache cache{combinations, 64, 4};
+    std::vector<std::thread> threads;
+    for (std::size_t i = 0; i < 4; ++i) {
+        threads.emplace_back([&cache] {
+            std::vector<int> order;
+            for (std::size_t j = 0; j < 100; ++j) {
+                ASSERT_NE(nullptr, cache.match(j % 2 ? calendar : calendar_reversed, order));
+                ASSERT_EQ(nullptr, cache.match(unclassified, order));
+            }
+        });
+    }
+    for (auto& t : threads) {
+        t.join();
+    }
+    ASSERT_EQ(800, cache.hits() + cache.misses());
+    ASSERT_LE(cache.misses(), 8);
+}
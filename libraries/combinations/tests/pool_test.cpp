@@ -0,0 +1,147 @@
+#include <future>
+#include <vector>
+
+#include "combinations/ClassifierPool.hpp"
+#include "combinations/Combinations.hpp"
+#include "combinations/Component.hpp"
+#include "gtest/gtest.h"
+
+namespace {
+
+const ClassifierPool::Batch test_data = {
+    {
+        Component::from_string("C 1 100 2013-10-19"),
+        Component::from_string("P 1 100 2013-10-19"),
+    },
+    {
+        Component::from_string("P 1 100 2013-10-18"),
+        Component::from_string("C 1 100 2013-10-19"),
+    },
+    {
+        Component::from_string("F 1 2013-12-21"),
+        Component::from_string("F -2 2013-11-16"),
+        Component::from_string("F 1 2013-10-19"),
+    },
+    {
+        Component::from_string("U -10 2010-03-01"),
+        Component::from_string("C -1 2100 2010-03-02"),
+        Component::from_string("P 1 2000 2010-03-02"),
+        Component::from_string("C 1 2100 2010-03-01"),
+        Component::from_string("P -1 2000 2010-03-01"),
+    },
+};
+
+struct PoolTest: ::testing::Test {
+    const std::filesystem::path path{"test/etc/combinations.xml"};
+    Combinations combinations;
+
+    PoolTest() { combinations.load(path); }
+
+    ClassifierPool::Batch make_batch(std::size_t size) const {
+        ClassifierPool::Batch batch;
+        batch.reserve(size);
+        for (std::size_t i = 0; i < size; ++i) {
+            batch.push_back(test_data[i % test_data.size()]);
+        }
+        return batch;
+    }
+
+    void expect_classified(const ClassifierPool::Batch& batch, const ClassifiedBatch& result) const {
+        ClassifiedBatch expected;
+        combinations.classify_batch(batch, expected);
+        EXPECT_EQ(expected.rules, result.rules);
+        EXPECT_EQ(expected.offsets, result.offsets);
+        EXPECT_EQ(expected.orders, result.orders);
+    }
+};
+
+}  // anonymous namespace
+
+TEST_F(PoolTest, future) {
+    ClassifierPool pool{combinations, 4};
+    ASSERT_EQ(4, pool.size());
+
+    for (const std::size_t size : {0, 1, 7, 1000}) {
+        const auto batch = make_batch(size);
+        auto future      = pool.submit(ClassifierPool::Batch(batch));
+        expect_classified(batch, future.get());
+    }
+}
+
+TEST_F(PoolTest, callback) {
+    const auto batch = make_batch(500);
+    std::promise<ClassifiedBatch> promise;
+    {
+        ClassifierPool pool{combinations, 3};
+        pool.submit(ClassifierPool::Batch(batch),
+                    [&promise](ClassifiedBatch&& result) { promise.set_value(std::move(result)); });
+    }
+    expect_classified(batch, promise.get_future().get());
+}
+
+TEST_F(PoolTest, many_batches) {
+    ClassifierPool pool{combinations, 6};
+    const auto batch = make_batch(250);
+
+    std::vector<std::future<ClassifiedBatch>> futures;
+    for (std::size_t i = 0; i < 20; ++i) {
+        futures.push_back(pool.submit(ClassifierPool::Batch(batch)));
+    }
+    for (auto& future : futures) {
+        expect_classified(batch, future.get());
+    }
+}
+
+TEST_F(PoolTest, match) {
+    const std::vector<std::vector<Component>> requests = {
+        test_data[0],
+        {
+            Component::from_string("F 1 2010-09-01"), Component::from_string("F 1 2010-06-01"),
+            Component::from_string("F 1 2010-03-01"), Component::from_string("F 1 2010-03-01"),
+            Component::from_string("F 1 2010-09-01"), Component::from_string("F 1 2010-12-01"),
+            Component::from_string("F 1 2010-12-01"), Component::from_string("F 1 2010-06-01"),
+        },
+        std::vector<Component>(8, Component::from_string("F 1 2010-03-01")),
+        std::vector<Component>(8, Component::from_string("F -1 2010-03-01")),
+    };
+
+    ClassifierPool pool{combinations, 4};
+    for (const auto& components : requests) {
+        std::vector<int> expected;
+        std::vector<int> order;
+        const Combination* rule = combinations.match(components, expected);
+        ASSERT_EQ(rule, pool.match(components, order));
+        ASSERT_EQ(expected, order);
+    }
+    std::vector<int> order;
+    ASSERT_EQ("Bundle", pool.match(requests[1], order)->get_name());
+    ASSERT_EQ("Strip", pool.match(requests[2], order)->get_name());
+    ASSERT_EQ(nullptr, pool.match(requests[3], order));
+}
+
+TEST_F(PoolTest, match_stats) {
+    if (!rule_stats_enabled) {
+        return;
+    }
+
+    const std::vector<Component> bundle = {
+        Component::from_string("F 1 2010-03-01"), Component::from_string("F 1 2010-06-01"),
+        Component::from_string("F 1 2010-09-01"), Component::from_string("F 1 2010-12-01"),
+        Component::from_string("F 1 2010-03-01"), Component::from_string("F 1 2010-06-01"),
+        Component::from_string("F 1 2010-09-01"), Component::from_string("F 1 2010-12-01"),
+    };
+    std::vector<int> order;
+    {
+        ClassifierPool pool{combinations, 2};
+        ASSERT_EQ("Bundle", pool.match(bundle, order)->get_name());
+    }
+
+    // Later candidates run concurrently and may be counted too, unless they were stopped in time
+    const std::vector<RuleCounters> stats = combinations.stats();
+    for (std::size_t rule = 0; rule < stats.size(); ++rule) {
+        if (combinations.rule_name(rule) == "Bundle") {
+            ASSERT_EQ(1, stats[rule].attempts);
+            ASSERT_EQ(1, stats[rule].matches);
+        }
+    }
+}
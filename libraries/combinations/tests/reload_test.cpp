@@ -0,0 +1,87 @@
+#include <atomic>
+#include <chrono>
+#include <filesystem>
+#include <stop_token>
+#include <thread>
+#include <vector>
+
+#include "combinations/Combinations.hpp"
+#include "combinations/Component.hpp"
+#include "combinations/ReloadableCombinations.hpp"
+#include "gtest/gtest.h"
+
+namespace {
+
+const std::vector<Component> butterfly = {
+    Component::from_string("F 1 2013-12-21"),
+    Component::from_string("F 1 2013-10-19"),
+    Component::from_string("F -2 2013-11-16"),
+};
+
+struct ReloadTest: ::testing::Test {
+    const std::filesystem::path path{"test/reload.xml"};
+
+    void install(const std::filesystem::path& resource) const {
+        std::filesystem::copy_file(resource, path, std::filesystem::copy_options::overwrite_existing);
+    }
+
+    static bool wait_generation(const ReloadableCombinations& combinations, std::size_t generation) {
+        for (int i = 0; i < 1000 && combinations.generation() < generation; ++i) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(5));
+        }
+        return combinations.generation() >= generation;
+    }
+};
+
+}  // anonymous namespace
+
+TEST_F(ReloadTest, reload) {
+    install("test/etc/combinations.xml");
+    ReloadableCombinations combinations{path};
+
+    std::vector<int> order;
+    ASSERT_EQ("Unclassified", combinations.classify(butterfly, order));
+    ASSERT_TRUE(combinations.reload());
+    ASSERT_EQ(1, combinations.generation());
+    ASSERT_EQ("Future butterfly", combinations.classify(butterfly, order));
+
+    const auto snapshot = combinations.snapshot();
+    install("test/etc/empty.xml");
+    ASSERT_FALSE(combinations.reload());
+    ASSERT_EQ(1, combinations.failures());
+    ASSERT_EQ(snapshot, combinations.snapshot());
+
+    install("test/etc/combinations.xml");
+    combinations.request_reload();
+    ASSERT_TRUE(wait_generation(combinations, 2));
+    ASSERT_NE(snapshot, combinations.snapshot());
+    ASSERT_EQ(snapshot->size(), combinations.snapshot()->size());
+    ASSERT_EQ("Future butterfly", snapshot->classify(butterfly, order));
+}
+
+TEST_F(ReloadTest, concurrent_readers) {
+    install("test/etc/combinations.xml");
+    ReloadableCombinations combinations{path};
+    ASSERT_TRUE(combinations.reload());
+
+    // The readers stop and are joined whenever the test returns, even on a failed assertion
+    std::atomic<std::size_t> mismatches{0};
+    std::vector<std::jthread> readers;
+    for (int i = 0; i < 4; ++i) {
+        readers.emplace_back([&](std::stop_token stop) {
+            std::vector<int> order;
+            while (!stop.stop_requested()) {
+                if (combinations.classify(butterfly, order) != "Future butterfly") {
+                    mismatches++;
+                }
+            }
+        });
+    }
+
+    for (std::size_t generation = 2; generation <= 5; ++generation) {
+        combinations.request_reload();
+        ASSERT_TRUE(wait_generation(combinations, generation));
+    }
+    readers.clear();
+    ASSERT_EQ(0, mismatches);
+}
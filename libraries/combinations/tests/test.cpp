@@ -1,3 +1,10 @@
+#include <fstream>
+#include <latch>
+#include <memory>
+#include <sstream>
+#include <thread>
+
+#include "combinations/BuiltinRules.hpp"
 #include "combinations/Combinations.hpp"
 #include "combinations/Component.hpp"
 #include "gtest/gtest.h"
@@ -18,6 +25,93 @@ TEST(ComponentTest, from_string_basic) {
     EXPECT_EQ(InstrumentType::Unknown, Component::from_string("O 1 2 blabla").type);
 }
 
+TEST(ComponentTest, parse) {
+    Component component;
+    ASSERT_TRUE(Component::parse("C -1.5 2.5 2020-02-02", component));
+    EXPECT_EQ(InstrumentType::C, component.type);
+    EXPECT_EQ(-1.5, component.ratio);
+    EXPECT_EQ(2.5, component.strike);
+    EXPECT_EQ(Date(2020, 2, 2), component.expiration);
+
+    ASSERT_TRUE(Component::parse("  F +2 2010-3-1\r", component));
+    EXPECT_EQ(InstrumentType::F, component.type);
+    EXPECT_EQ(2, component.ratio);
+    EXPECT_EQ(Date(2010, 3, 1), component.expiration);
+
+    EXPECT_FALSE(Component::parse("F 1 2020-13-02", component));
+    EXPECT_EQ(InstrumentType::Unknown, component.type);
+    EXPECT_FALSE(Component::parse("F +-1 2020-02-02", component));
+    EXPECT_FALSE(Component::parse("C 1 2020-02-02", component));
+    EXPECT_FALSE(Component::parse("P 1 100 2020/02/02", component));
+}
+
+TEST(ComponentTest, invalid_day) {
+    Component component;
+    EXPECT_TRUE(Component::parse("F 1 2012-02-29", component));
+    EXPECT_FALSE(Component::parse("F 1 2010-02-29", component));
+    EXPECT_FALSE(Component::parse("F 1 2012-02-30", component));
+    EXPECT_FALSE(Component::parse("F 1 2012-02-31", component));
+    EXPECT_FALSE(Component::parse("F 1 2010-04-31", component));
+    EXPECT_TRUE(Component::parse("F 1 2010-05-31", component));
+
+    for (const char* str : {"F 1 2010-02-29", "F 1 2012-02-30", "F 1 2012-02-31", "F 1 2010-04-31"}) {
+        std::istringstream stream(str);
+        EXPECT_EQ(InstrumentType::Unknown, Component::from_stream(stream).type) << str;
+    }
+    std::istringstream stream("F 1 2012-02-29");
+    EXPECT_EQ(Date(2012, 2, 29), Component::from_stream(stream).expiration);
+}
+
+TEST(ComponentTest, non_finite) {
+    for (const char* str : {"F nan 2010-03-01", "F inf 2010-03-01", "F -infinity 2010-03-01", "C 1 nan 2010-03-01",
+                            "P 1 inf 2010-03-01", "C 1 NAN 2010-03-01", "F 1e400 2010-03-01"}) {
+        Component component;
+        std::istringstream stream(str);
+        EXPECT_EQ(Component::from_stream(stream).type != InstrumentType::Unknown, Component::parse(str, component))
+            << str;
+        EXPECT_EQ(InstrumentType::Unknown, component.type) << str;
+    }
+}
+
+TEST(DateTest, check_offset) {
+    const Date date{2010, 1, 31};
+    EXPECT_TRUE(date.check_offset(ExpirationOffset(2, TimePeriods::d), Date{2010, 2, 2}));
+    EXPECT_TRUE(date.check_offset(ExpirationOffset(60, TimePeriods::d), Date{2010, 4, 1}));
+    EXPECT_TRUE(date.check_offset(ExpirationOffset(1, TimePeriods::m), Date{2010, 3, 3}));
+    EXPECT_TRUE(date.check_offset(ExpirationOffset(1, TimePeriods::q), Date{2010, 4, 15}));
+    EXPECT_TRUE(date.check_offset(ExpirationOffset(3, TimePeriods::y), Date{2013, 1, 31}));
+    EXPECT_FALSE(date.check_offset(ExpirationOffset(1, TimePeriods::q), Date{2010, 5, 1}));
+    EXPECT_TRUE(Date(2012, 2, 28).check_offset(ExpirationOffset(2, TimePeriods::d), Date{2012, 3, 1}));
+    EXPECT_TRUE(Date(2012, 2, 29).check_offset(ExpirationOffset(1, TimePeriods::y), Date{2013, 3, 1}));
+    EXPECT_TRUE(Date(2010, 12, 31) < Date(2011, 1, 1));
+}
+
+TEST(RatioHistogramTest, covers) {
+    const std::vector<Leg> legs = {
+        {InstrumentType::C, 1.0, 'A', 'a'},
+        {InstrumentType::C, -2.0, 'A', 'a'},
+        {InstrumentType::P, '+', 'A', 'a'},
+        {InstrumentType::F, 5.0, 'A', 'a'},
+    };
+    const RatioHistogram rule = RatioHistogram::of(legs);
+
+    const std::vector<Component> accepted = {
+        Component::from_string("C 1 100 2013-10-19"),
+        Component::from_string("C -2 100 2013-10-19"),
+        Component::from_string("P 7 100 2013-10-19"),
+        Component::from_string("F 1 2013-10-19"),
+    };
+    ASSERT_TRUE(RatioHistogram::of(accepted).covers(rule));
+
+    const std::vector<Component> rejected = {
+        Component::from_string("C 1 100 2013-10-19"),
+        Component::from_string("C -1 100 2013-10-19"),
+        Component::from_string("P 1 100 2013-10-19"),
+    };
+    ASSERT_FALSE(RatioHistogram::of(rejected).covers(rule));
+    ASSERT_TRUE(RatioHistogram::of(std::vector<Component>()).covers(RatioHistogram::of(std::vector<Leg>{legs[2]})));
+}
+
 TEST(CombinationsResourceTest, empty_path) {
     Combinations combinations;
     ASSERT_FALSE(combinations.load({}));
@@ -41,6 +135,177 @@ TEST(CombinationsResourceTest, empty_resource) {
     ASSERT_FALSE(combinations.load(path));
 }
 
+TEST(CombinationsResourceTest, no_legs) {
+    Combinations combinations;
+    ASSERT_TRUE(combinations.load("test/etc/no_legs.xml"));
+    ASSERT_EQ(2, combinations.size());
+
+    const std::vector<std::vector<Component>> batch = {{}, {Component::from_string("F 1 2013-10-19")}};
+    std::vector<int> order;
+    ASSERT_EQ("No legs", combinations.classify(batch[0], order));
+    ASSERT_EQ("Unclassified", combinations.classify(batch[1], order));
+
+    ClassifiedBatch result;
+    combinations.classify_batch(ComponentBatch{batch}, result);
+    ASSERT_EQ(0, result.rules[0]);
+    ASSERT_EQ(Combinations::unclassified, result.rules[1]);
+}
+
+TEST(CombinationsResourceTest, too_many_symbols) {
+    Combinations combinations;
+    ASSERT_FALSE(combinations.load("test/etc/too_many_symbols.xml"));
+    ASSERT_EQ(0, combinations.size());
+
+    ASSERT_TRUE(combinations.load("test/etc/no_legs.xml"));
+    ASSERT_FALSE(combinations.load("test/etc/too_many_symbols.xml"));
+    ASSERT_EQ(2, combinations.size());
+}
+
+TEST(CombinationsResourceTest, compiled) {
+    Combinations source;
+    ASSERT_TRUE(source.load("test/etc/combinations.xml"));
+    ASSERT_TRUE(source.save_compiled("test/combinations.bin"));
+
+    Combinations combinations;
+    ASSERT_TRUE(combinations.load_compiled("test/combinations.bin"));
+    ASSERT_EQ(source.size(), combinations.size());
+    for (std::size_t i = 0; i < source.size(); ++i) {
+        ASSERT_EQ(source.rule(i)->get_identifier(), combinations.rule(i)->get_identifier());
+        ASSERT_EQ(source.rule(i)->get_cardinality(), combinations.rule(i)->get_cardinality());
+        ASSERT_EQ(source.rule(i)->get_legs().size(), combinations.rule(i)->get_legs().size());
+    }
+
+    const std::vector<Component> components = {
+        Component::from_string("F 1 2013-12-21"),
+        Component::from_string("F 1 2013-10-19"),
+        Component::from_string("F -2 2013-11-16"),
+    };
+    std::vector<int> expected;
+    std::vector<int> order;
+    ASSERT_EQ(source.classify(components, expected), combinations.classify(components, order));
+    ASSERT_EQ(expected, order);
+}
+
+TEST(CombinationsResourceTest, compiled_corrupted) {
+    Combinations source;
+    ASSERT_TRUE(source.load("test/etc/combinations.xml"));
+    ASSERT_TRUE(source.save_compiled("test/corrupted.bin"));
+    {
+        std::fstream file("test/corrupted.bin", std::ios::binary | std::ios::in | std::ios::out);
+        file.seekp(100);
+        file.put('\xff');
+    }
+
+    Combinations combinations;
+    ASSERT_FALSE(combinations.load_compiled("test/corrupted.bin"));
+    ASSERT_EQ(0, combinations.size());
+    ASSERT_FALSE(combinations.load_compiled("test/etc/combinations.xml"));
+    ASSERT_FALSE(combinations.load_compiled("test/etc/unknown.bin"));
+}
+
+TEST(CombinationsResourceTest, builtin) {
+    Combinations source;
+    ASSERT_TRUE(source.load("test/etc/combinations.xml"));
+
+    Combinations combinations;
+    ASSERT_TRUE(load_builtin_rules(combinations));
+    ASSERT_EQ(source.size(), combinations.size());
+    ASSERT_EQ(source.compiled_image(), combinations.compiled_image());
+
+    std::string image = source.compiled_image();
+    image.back() ^= 1;
+    ASSERT_FALSE(combinations.load_image(image));
+    ASSERT_FALSE(combinations.load_image({}));
+}
+
+TEST(RuleStatsTest, exited_threads) {
+    RuleStats stats{2};
+    for (int round = 0; round < 3; ++round) {
+        std::vector<std::thread> threads;
+        for (int i = 0; i < 4; ++i) {
+            threads.emplace_back([&stats] {
+                stats.add(0, RuleStats::attempts, 1);
+                stats.add(1, RuleStats::placements, 2);
+            });
+        }
+        for (auto& thread : threads) {
+            thread.join();
+        }
+        ASSERT_EQ(0, stats.threads());
+    }
+
+    stats.add(0, RuleStats::attempts, 1);
+    ASSERT_EQ(1, stats.threads());
+    stats.resize(3);
+    const std::vector<RuleCounters> total = stats.total();
+    ASSERT_EQ(3, total.size());
+    ASSERT_EQ(13, total[0].attempts);
+    ASSERT_EQ(24, total[1].placements);
+    ASSERT_EQ(0, total[2].attempts);
+
+    // A thread exiting once the instance it counted for is gone leaves it alone
+    auto destroyed = std::make_unique<RuleStats>(1);
+    std::latch counted{1};
+    std::latch released{1};
+    std::thread thread([&] {
+        destroyed->add(0, RuleStats::attempts, 1);
+        counted.count_down();
+        released.wait();
+    });
+    counted.wait();
+    destroyed.reset();
+    released.count_down();
+    thread.join();
+}
+
+TEST(CombinationsResourceTest, stats) {
+    Combinations combinations;
+    ASSERT_TRUE(combinations.load("test/etc/combinations.xml"));
+    if (!rule_stats_enabled) {
+        ASSERT_TRUE(combinations.stats().empty());
+        return;
+    }
+
+    const std::vector<Component> components = {
+        Component::from_string("F 1 2013-12-21"),
+        Component::from_string("F 1 2013-10-19"),
+        Component::from_string("F -2 2013-11-16"),
+    };
+    std::vector<std::thread> threads;
+    for (int i = 0; i < 4; ++i) {
+        threads.emplace_back([&] {
+            std::vector<int> order;
+            for (int j = 0; j < 25; ++j) {
+                combinations.classify(components, order);
+            }
+        });
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+
+    const std::vector<RuleCounters> stats = combinations.stats();
+    ASSERT_EQ(combinations.size(), stats.size());
+    RuleCounters total;
+    for (std::size_t rule = 0; rule < stats.size(); ++rule) {
+        total += stats[rule];
+        ASSERT_EQ(combinations.rule_name(rule) == "Future butterfly" ? 100 : 0, stats[rule].matches);
+    }
+    ASSERT_EQ(100, total.matches);
+    ASSERT_LE(total.matches, total.attempts);
+    ASSERT_LE(total.attempts, total.placements + total.type_rejects);
+
+    // Rules loaded later get counters of their own, the ones counted so far are kept
+    const std::size_t rules = combinations.size();
+    ASSERT_TRUE(combinations.load("test/etc/combinations.xml"));
+    const std::vector<RuleCounters> reloaded = combinations.stats();
+    ASSERT_EQ(2 * rules, reloaded.size());
+    for (std::size_t rule = 0; rule < rules; ++rule) {
+        ASSERT_EQ(stats[rule].attempts, reloaded[rule].attempts);
+        ASSERT_EQ(0, reloaded[rules + rule].attempts);
+    }
+}
+
 class CombinationsTest: public ::testing::Test {
 public:
     static const auto& combinations() { return m_combinations; }
@@ -145,6 +410,241 @@ TEST_F(CombinationsTest, order_shuffle) {
     ASSERT_EQ(1, (order[7] - 1) % 4);
 }
 
+TEST_F(CombinationsTest, classify_batch) {
+    const std::vector<std::vector<Component>> batch = {
+        {
+            Component::from_string("C 1 100 2013-10-19"),
+            Component::from_string("P 1 100 2013-10-19"),
+        },
+        {
+            Component::from_string("P 1 100 2013-10-18"),
+            Component::from_string("C 1 100 2013-10-19"),
+        },
+        {},
+        {
+            Component::from_string("F 1 2013-12-21"),
+            Component::from_string("F -2 2013-11-16"),
+            Component::from_string("F 1 2013-10-19"),
+        },
+    };
+
+    ClassifiedBatch result;
+    for (const std::size_t threads : {1, 3, 8}) {
+        combinations().classify_batch(batch, result, threads);
+        ASSERT_EQ(batch.size(), result.rules.size());
+        ASSERT_EQ(batch.size() + 1, result.offsets.size());
+        for (std::size_t i = 0; i < batch.size(); ++i) {
+            std::vector<int> order;
+            ASSERT_EQ(combinations().classify(batch[i], order), combinations().rule_name(result.rules[i]));
+            if (order.empty()) {
+                order.resize(batch[i].size());
+            }
+            ASSERT_TRUE(std::equal(order.begin(), order.end(), result.orders.begin() + result.offsets[i],
+                                   result.orders.begin() + result.offsets[i + 1]));
+        }
+    }
+}
+
+TEST_F(CombinationsTest, component_batch) {
+    const std::vector<std::vector<Component>> batch = {
+        {
+            Component::from_string("C 1 100 2013-10-19"),
+            Component::from_string("P 1 100 2013-10-19"),
+        },
+        {},
+        {
+            Component::from_string("F 1 2013-12-21"),
+            Component::from_string("F -2 2013-11-16"),
+            Component::from_string("F 1 2013-10-19"),
+        },
+        {
+            Component::from_string("U -10 2010-03-01"),
+            Component::from_string("C -1 2100 2010-03-02"),
+            Component::from_string("P 1 2000 2010-03-02"),
+            Component::from_string("C 1 2100 2010-03-01"),
+            Component::from_string("P -1 2000 2010-03-01"),
+        },
+        // Sets reaching the rules of any number of legs, accepted or rejected from the columns alone.
+        {
+            Component::from_string("F 1 2013-10-19"),
+            Component::from_string("F 2 2013-11-16"),
+            Component::from_string("F 1 2013-12-21"),
+        },
+        {
+            Component::from_string("F 1 2013-10-19"),
+            Component::from_string("F -1 2013-11-16"),
+            Component::from_string("F 1 2013-12-21"),
+            Component::from_string("F 1 2014-01-18"),
+        },
+        {
+            Component::from_string("C 1 100 2013-10-19"),
+            Component::from_string("P 1 100 2013-11-16"),
+            Component::from_string("C 1 110 2013-12-21"),
+            Component::from_string("P 1 110 2014-01-18"),
+        },
+        {
+            Component::from_string("C 1 100 2013-10-19"),
+            Component::from_string("P 2 100 2013-11-16"),
+            Component::from_string("C 1 110 2013-12-21"),
+            Component::from_string("P 1 110 2014-01-18"),
+        },
+        {
+            Component::from_string("C 1 100 2013-10-19"),
+            Component::from_string("F 1 2013-11-16"),
+            Component::from_string("C 1 110 2013-12-21"),
+            Component::from_string("P 1 110 2014-01-18"),
+        },
+        {
+            Component::from_string("F 1 2013-10-19"),
+        },
+    };
+
+    const ComponentBatch columns{batch};
+    ASSERT_EQ(batch.size(), columns.size());
+    std::vector<Component> components;
+    for (std::size_t i = 0; i < batch.size(); ++i) {
+        ASSERT_EQ(LegsSignature::of(batch[i]), LegsSignature::of(columns, i));
+        ASSERT_EQ(RatioHistogram::of(batch[i]).counts, RatioHistogram::of(columns, i).counts);
+        columns.get(i, components);
+        ASSERT_EQ(batch[i].size(), components.size());
+        for (std::size_t j = 0; j < components.size(); ++j) {
+            ASSERT_EQ(batch[i][j].type, components[j].type);
+            ASSERT_EQ(batch[i][j].ratio, components[j].ratio);
+            ASSERT_EQ(batch[i][j].strike, components[j].strike);
+            ASSERT_EQ(batch[i][j].expiration, components[j].expiration);
+        }
+    }
+
+    ClassifiedBatch expected;
+    combinations().classify_batch(batch, expected);
+    for (const std::size_t threads : {1, 3}) {
+        ClassifiedBatch result;
+        combinations().classify_batch(columns, result, threads);
+        ASSERT_EQ(expected.rules, result.rules);
+        ASSERT_EQ(expected.offsets, result.offsets);
+        ASSERT_EQ(expected.orders, result.orders);
+    }
+    ASSERT_NE(Combinations::unclassified, expected.rules[4]);
+    ASSERT_EQ(Combinations::unclassified, expected.rules[5]);
+    ASSERT_NE(Combinations::unclassified, expected.rules[6]);
+    ASSERT_EQ(Combinations::unclassified, expected.rules[7]);
+    ASSERT_EQ(Combinations::unclassified, expected.rules[8]);
+    ASSERT_EQ(Combinations::unclassified, expected.rules[9]);
+}
+
+TEST_F(CombinationsTest, match) {
+    const std::vector<Component> components = {
+        Component::from_string("F 1 2013-12-21"),
+        Component::from_string("F 1 2013-10-19"),
+        Component::from_string("F -2 2013-11-16"),
+    };
+    std::vector<int> order;
+    const Combination* rule = combinations().match(components, order);
+    ASSERT_NE(nullptr, rule);
+    ASSERT_EQ("Future butterfly", rule->get_name());
+    ASSERT_EQ("FB", rule->get_shortname());
+    ASSERT_EQ("d45880f0-575b-11df-bc39-ebffbea5b361", rule->get_identifier());
+    ASSERT_EQ((std::vector<int>{3, 1, 2}), order);
+
+    ASSERT_EQ(nullptr, combinations().match({components[1], components[2]}, order));
+    ASSERT_TRUE(order.empty());
+}
+
+TEST_F(CombinationsTest, infeasible_bundle) {
+    // Only a Strip fits: the Bundle legs take no ratio of 2, which the search would only find out after trying every
+    // assignment of the other futures.
+    std::vector<Component> components;
+    for (int year = 0; year < 3; ++year) {
+        for (const char* date : {"2010-03-01", "2010-06-01", "2010-09-01", "2010-12-01"}) {
+            components.push_back(Component::from_string(std::string("F 1 ") + date));
+        }
+    }
+    components.back().ratio = 2;
+
+    std::vector<int> order;
+    ASSERT_EQ("Strip", combinations().classify(components, order));
+    ASSERT_EQ(components.size(), order.size());
+    ASSERT_TRUE(check_order_basic(order));
+}
+
+TEST_F(CombinationsTest, bundle_overlapping_groups) {
+    // The first group starts in June, not in March, as the March one would leave the 2011 future out.
+    const std::vector<Component> components = {
+        Component::from_string("F 1 2011-03-01"), Component::from_string("F 1 2010-06-01"),
+        Component::from_string("F 1 2010-09-01"), Component::from_string("F 1 2010-12-01"),
+        Component::from_string("F 1 2010-03-01"), Component::from_string("F 1 2010-09-01"),
+        Component::from_string("F 1 2010-06-01"), Component::from_string("F 1 2010-12-01"),
+    };
+    std::vector<int> order;
+    ASSERT_EQ("Bundle", combinations().classify(components, order));
+    ASSERT_EQ(std::vector<int>({4, 1, 2, 3, 5, 7, 6, 8}), order);
+}
+
+TEST_F(CombinationsTest, bundle_long) {
+    std::vector<Component> components;
+    for (int year = 2030; year >= 2010; --year) {
+        for (const char* date : {"-12-01", "-09-01", "-06-01", "-03-01"}) {
+            components.push_back(Component::from_string("F 1 " + std::to_string(year) + date));
+        }
+    }
+
+    std::vector<int> order;
+    ASSERT_EQ("Bundle", combinations().classify(components, order));
+    ASSERT_EQ(components.size(), order.size());
+    ASSERT_TRUE(check_order_basic(order));
+    for (int i = 0, end = order.size(); i < end; ++i) {
+        ASSERT_EQ(3 - (i % 4), (order[i] - 1) % 4);
+    }
+
+    components.pop_back();
+    components.push_back(Component::from_string("F 1 2031-06-01"));
+    ASSERT_NE("Bundle", combinations().classify(components, order));
+}
+
+TEST_F(CombinationsTest, underlying_variants) {
+    // The base structure is searched for only by the variant of the underlying sign.
+    std::vector<Component> components = {
+        Component::from_string("C 1 2000 2010-03-01"),
+        Component::from_string("C -2 2100 2010-03-01"),
+        Component::from_string("C 1 2200 2010-03-01"),
+        Component::from_string("U 10 2010-03-01"),
+    };
+    for (const auto& [ratio, variant, other] : {std::tuple(10, "CBvbU", "CBvsU"), std::tuple(-10, "CBvsU", "CBvbU")}) {
+        components.back().ratio = ratio;
+        std::vector<std::size_t> rules;
+        combinations().candidates(components, rules);
+
+        std::vector<std::string> names;
+        for (const std::size_t rule : rules) {
+            names.push_back(combinations().rule(rule)->get_shortname());
+        }
+        ASSERT_NE(names.end(), std::find(names.begin(), names.end(), variant));
+        ASSERT_EQ(names.end(), std::find(names.begin(), names.end(), other));
+    }
+}
+
+TEST_F(CombinationsTest, sorted_values_rotations) {
+    // The candidates of the bound strike and the expiration offsets come from the sorted values, whichever the order
+    // of the components.
+    std::vector<Component> components = {
+        Component::from_string("C 1 2000 2010-09-01"), Component::from_string("P 1 2000 2010-03-01"),
+        Component::from_string("P 1 2000 2010-06-01"), Component::from_string("C 1 2000 2010-06-01"),
+        Component::from_string("P 1 2000 2010-09-01"), Component::from_string("P 1 2000 2010-12-01"),
+        Component::from_string("C 1 2000 2010-12-01"), Component::from_string("C 1 2000 2010-03-01"),
+    };
+    std::vector<int> expected;
+    ASSERT_EQ("Straddle strip", combinations().classify(components, expected));
+
+    for (std::size_t shift = 1; shift < components.size(); ++shift) {
+        std::rotate(components.begin(), components.begin() + 1, components.end());
+        std::vector<int> order;
+        ASSERT_EQ("Straddle strip", combinations().classify(components, order));
+        for (std::size_t i = 0; i < order.size(); ++i) {
+            ASSERT_EQ(expected[(i + shift) % expected.size()], order[i]);
+        }
+    }
+}
+
 TEST_F(CombinationsTest, min_count_ok) {
     const std::vector<Component> components = {
         Component::from_string("P 1 2000 2010-03-01"),
@@ -0,0 +1,55 @@
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+
+#include "combinations/Combinations.hpp"
+
+// Writes a translation unit defining load_builtin_rules of BuiltinRules.hpp, which loads the rules of the given
+// resource from an image compiled into it.
+
+namespace {
+
+constexpr std::size_t bytes_per_line = 16;
+
+int fail(const char *message, const char *path) {
+    std::cerr << message << path << std::endl;
+    return 1;
+}
+
+}  // anonymous namespace
+
+int main(int argc, char *argv[]) {
+    if (argc != 3) {
+        std::cerr << "Usage: rules_codegen <combinations resource> <output file>" << std::endl;
+        return 1;
+    }
+
+    Combinations combinations;
+    if (!combinations.load(argv[1])) {
+        return fail("Failed to load combinations resource from ", argv[1]);
+    }
+    const std::string image = combinations.compiled_image();
+
+    std::ofstream out(argv[2], std::ios::trunc);
+    out << "// Generated by rules_codegen from " << std::filesystem::path(argv[1]).filename().string()
+        << ", do not edit.\n\n"
+        << "#include \"combinations/BuiltinRules.hpp\"\n\n"
+        << "namespace {\n\n"
+        << "constexpr unsigned char image[] = {";
+    out << std::hex << std::setfill('0');
+    for (std::size_t i = 0; i < image.size(); i++) {
+        out << (i % bytes_per_line ? " " : "\n    ") << "0x" << std::setw(2)
+            << static_cast<unsigned>(static_cast<unsigned char>(image[i])) << ',';
+    }
+    out << "\n};\n\n"
+        << "}  // anonymous namespace\n\n"
+        << "bool load_builtin_rules(Combinations& combinations) {\n"
+        << "    const std::string_view data(reinterpret_cast<const char*>(image), sizeof(image));\n"
+        << "    return combinations.load_image(data);\n"
+        << "}\n";
+
+    if (!out.flush()) {
+        return fail("Failed to write generated rules to ", argv[2]);
+    }
+    return 0;
+}
@@ -1,12 +1,18 @@
+#include <algorithm>
+#include <charconv>
+#include <fstream>
 #include <iomanip>
 #include <iostream>
 #include <string>
+#include <string_view>
 
 #include "combinations/Combinations.hpp"
 #include "combinations/Component.hpp"
 
 namespace {
 
+constexpr std::size_t max_legs = 100000;
+
 template <typename... Args>
 int fail(Args &&...args) noexcept {
     ((std::cerr << args), ...);
@@ -14,40 +20,219 @@ int fail(Args &&...args) noexcept {
     return 1;
 }
 
-}  // anonymous namespace
+constexpr std::string_view spaces = " \t\n\v\f\r";
 
-int main(int argc, char *argv[]) {
-    if (argc != 2) {
-        return fail("Usage: combinations <combinations XML resource>");
+bool blank(std::string_view line) {
+    return line.find_first_not_of(spaces) == std::string_view::npos;
+}
+
+// Splits the next token off the line, empty once the line is over.
+std::string_view next_token(std::string_view &line) {
+    const std::size_t begin      = std::min(line.find_first_not_of(spaces), line.size());
+    const std::size_t end        = std::min(line.find_first_of(spaces, begin), line.size());
+    const std::string_view token = line.substr(begin, end - begin);
+    line.remove_prefix(end);
+    return token;
+}
+
+bool parse_count(std::string_view token, std::size_t &num) {
+    const auto [ptr, ec] = std::from_chars(token.data(), token.data() + token.size(), num);
+    return !token.empty() && ec == std::errc() && ptr == token.data() + token.size();
+}
+
+// Reads the tokens of one leg, the type, the ratio, the strike of an option and the expiration, and parses them
+// gathered into leg. next returns the following token, or an empty one once the input is over.
+template <typename NextToken>
+bool read_leg(NextToken &&next, std::string &leg, Component &component) {
+    const std::string_view type = next();
+    if (type.size() != 1) {
+        return false;
+    }
+    std::size_t fields = 2;
+    switch (static_cast<InstrumentType>(type.front())) {
+    case InstrumentType::C:
+    case InstrumentType::O:
+    case InstrumentType::P:
+        fields = 3;
+        break;
+    case InstrumentType::F:
+    case InstrumentType::U:
+        break;
+    default:
+        return false;
     }
 
-    Combinations combinations;
+    leg.assign(type);
+    for (; fields; fields--) {
+        const std::string_view token = next();
+        if (token.empty()) {
+            return false;
+        }
+        leg += ' ';
+        leg += token;
+    }
+    return Component::parse(leg, component);
+}
 
-    const std::filesystem::path path{argv[1]};
-    if (!combinations.load(path)) {
-        return fail("Failed to load combinations XML resource from ", path);
+// Reads one record of a stream: the number of legs followed by the legs, one per line with nothing else on it.
+// Returns an error message or nullptr, `end` is set if the input is over before the record starts.
+const char *read_record(std::istream &in, std::string &line, std::string &leg, std::vector<Component> &components,
+                        bool &end) {
+    components.clear();
+
+    end = true;
+    while (std::getline(in, line)) {
+        if (!blank(line)) {
+            end = false;
+            break;
+        }
+    }
+    if (end) {
+        return nullptr;
+    }
+
+    std::size_t num       = 0;
+    std::string_view rest = line;
+    if (!parse_count(next_token(rest), num) || !blank(rest)) {
+        return "Invalid number of legs";
+    }
+
+    components.reserve(std::min<std::size_t>(num, max_legs));
+    while (num && std::getline(in, line)) {
+        if (blank(line)) {
+            continue;
+        }
+        rest = line;
+        if (!read_leg([&rest] { return next_token(rest); }, leg, components.emplace_back()) || !blank(rest)) {
+            return "Failed to read component";
+        }
+        num--;
+    }
+    if (num) {
+        return "Failed to read component";
+    }
+    return nullptr;
+}
+
+// Classifies records until the input is over, printing one line per record: the combination name, then a tab and
+// the order separated by spaces, or just "Unclassified".
+int classify_stream(const Combinations &combinations, std::istream &in) {
+    std::string line;
+    std::string leg;
+    std::vector<Component> components;
+    std::vector<int> order;
+    while (true) {
+        bool end = false;
+        if (const char *error = read_record(in, line, leg, components, end)) {
+            return fail(error);
+        }
+        if (end) {
+            return 0;
+        }
+
+        const Combination *rule = combinations.match(components, order);
+        if (!rule) {
+            std::cout << "Unclassified\n";
+            continue;
+        }
+        std::cout << rule->get_name() << '\t';
+        for (std::size_t i = 0; i < order.size(); i++) {
+            std::cout << (i ? " " : "") << order[i];
+        }
+        std::cout << '\n';
     }
+}
 
-    std::size_t num;
-    std::cin >> num;
-    if (std::cin.fail()) {
+// Classifies a single record, printing the combination name and then the order, one number per line. The number of
+// legs and the legs are read token by token, so they may be split between lines in any way.
+int classify_record(const Combinations &combinations) {
+    std::string token;
+    const auto next = [&token] { return std::cin >> token ? std::string_view(token) : std::string_view(); };
+
+    std::size_t num = 0;
+    if (!parse_count(next(), num)) {
         return fail("Invalid number of legs");
     }
 
+    std::string leg;
     std::vector<Component> components;
-    components.reserve(num);
+    components.reserve(std::min<std::size_t>(num, max_legs));
     while (num--) {
-        components.emplace_back(Component::from_stream(std::cin));
-        if (components.back().type == InstrumentType::Unknown) {
+        if (!read_leg(next, leg, components.emplace_back())) {
             return fail("Failed to read component");
         }
     }
 
     std::vector<int> order;
-    std::cout << combinations.classify(components, order) << std::endl;
+    std::cout << combinations.classify(components, order) << '\n';
     for (const auto i : order) {
-        std::cout << i << std::endl;
+        std::cout << i << '\n';
     }
-
     return 0;
 }
+
+int classify(const Combinations &combinations, bool stream, const char *input) {
+    if (!stream) {
+        return classify_record(combinations);
+    }
+    if (!input) {
+        return classify_stream(combinations, std::cin);
+    }
+    std::ifstream file{input};
+    if (!file) {
+        return fail("Failed to open input file ", input);
+    }
+    return classify_stream(combinations, file);
+}
+
+}  // anonymous namespace
+
+int main(int argc, char *argv[]) {
+    // The rules are read from the XML resource, or from a compiled image of them with --compiled. With --stats the
+    // per rule counters are printed to stderr once the input is classified.
+    bool compiled = false;
+    bool stats    = false;
+    for (; argc > 1; argc--, argv++) {
+        const std::string_view option{argv[1]};
+        if (option == "--compiled") {
+            compiled = true;
+        } else if (option == "--stats") {
+            stats = true;
+        } else {
+            break;
+        }
+    }
+
+    const bool stream  = argc > 2 && std::string_view(argv[2]) == "--stream";
+    const bool compile = argc == 4 && std::string_view(argv[2]) == "--compile";
+    if (argc != 2 && !(stream && argc <= 4) && !compile) {
+        return fail("Usage: combinations [--compiled] [--stats] <combinations resource> ",
+                    "[--stream [input file] | --compile <image file>]");
+    }
+    if (stats && !rule_stats_enabled) {
+        return fail("Rule statistics are not counted by this build, see COMBINATIONS_STATS");
+    }
+
+    std::ios::sync_with_stdio(false);
+
+    Combinations combinations;
+
+    const std::filesystem::path path{argv[1]};
+    if (compiled ? !combinations.load_compiled(path) : !combinations.load(path)) {
+        return fail("Failed to load combinations resource from ", path);
+    }
+
+    if (compile) {
+        if (!combinations.save_compiled(argv[3])) {
+            return fail("Failed to write compiled combinations to ", argv[3]);
+        }
+        return 0;
+    }
+
+    const int result = classify(combinations, stream, argc == 4 ? argv[3] : nullptr);
+    if (stats) {
+        std::cout.flush();
+        combinations.dump_stats(std::cerr);
+    }
+    return result;
+}
@@ -0,0 +1,30 @@
+# Runs the command line tool on records in the layouts it accepts, with MAIN, RESOURCE and WORK_DIR set by add_test
+
+function(expect_output name input expected)
+    set(input_file ${WORK_DIR}/${name}.txt)
+    file(WRITE ${input_file} "${input}")
+    execute_process(
+        COMMAND ${MAIN} ${RESOURCE} ${ARGN}
+        INPUT_FILE ${input_file}
+        OUTPUT_VARIABLE output
+        ERROR_VARIABLE error
+        RESULT_VARIABLE result)
+    if(NOT "${output}${error}" STREQUAL "${expected}")
+        message(FATAL_ERROR "${name}: expected\n${expected}\ngot\n${output}${error}(exit code ${result})")
+    endif()
+endfunction()
+
+file(MAKE_DIRECTORY ${WORK_DIR})
+
+# A single record is read token by token, whatever the lines
+expect_output(one_line "2 F 1 2010-01-01 F -1 2010-04-01\n" "Future calendar spread\n1\n2\n")
+expect_output(leg_per_line "2\nF 1 2010-01-01\nF -1 2010-04-01\n" "Future calendar spread\n1\n2\n")
+expect_output(split_legs "2 F 1\n2010-01-01 F\n-1 2010-04-01" "Future calendar spread\n1\n2\n")
+expect_output(missing_leg "2 F 1 2010-01-01\n" "Failed to read component\n")
+expect_output(invalid_count "two F 1 2010-01-01\n" "Invalid number of legs\n")
+
+# A stream takes one leg per line, with nothing else on it
+expect_output(stream "2\nF 1 2010-01-01\nF -1 2010-04-01\n\n1\nF 1 2010-01-01\n"
+    "Future calendar spread\t1 2\nUnclassified\n" --stream)
+expect_output(stream_trailing "2\nF 1 2010-01-01 F -1 2010-04-01\n" "Failed to read component\n" --stream)
+expect_output(stream_one_line "2 F 1 2010-01-01 F -1 2010-04-01\n" "Invalid number of legs\n" --stream)